@@ -0,0 +1,6 @@
+# Wraps a GLSL file in a raw string literal so it can be compiled into the binary.
+# Usage: cmake -DINPUT=<shader> -DOUTPUT=<header> -DNAME=<identifier> -P EmbedShader.cmake
+file(READ ${INPUT} SOURCE)
+file(WRITE ${OUTPUT}
+        "// Generated from ${INPUT}, do not edit.\n"
+        "const char* const ${NAME} = R\"glsl(${SOURCE})glsl\";\n")
@@ -1,3 +1,6 @@
+#ifndef __CAMERA_HPP
+#define __CAMERA_HPP
+
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -30,6 +33,22 @@ public:
                 return rotatez(-rotation.x) * rotatex(rotation.y);
         }
 
+        // Direction of the primary ray through screenPos in [-1, 1]^2, the
+        // same ray main() in VoxelShaderFrag.glsl casts.
+        glm::vec3 getRayDir(glm::vec2 screenPos) const {
+                auto d = getRotationTransform() * glm::vec4(screenPos.x, 1.0f, screenPos.y * 3.0f/4.0f, 0.0f);
+                return glm::normalize(glm::vec3(d));
+        }
+
+        // Inverse of getRayDir(): where point shows up on the screen. Returns
+        // false for points behind the camera.
+        bool project(glm::vec3 point, glm::vec2& screenPos) const {
+                auto local = glm::transpose(getRotationTransform()) * glm::vec4(point - position, 0.0f);
+                if (local.y <= 0.0f) { return false; }
+                screenPos = glm::vec2(local.x / local.y, local.z / local.y * 4.0f/3.0f);
+                return true;
+        }
+
         void move(glm::vec3 movement) {
                 position += glm::vec3(rotatez(-rotation.x) * rotatex(rotation.y) * glm::vec4(movement, 1));
         }
@@ -43,3 +62,5 @@ public:
                         getRotationTransform();
         }
 };
+
+#endif //__CAMERA_HPP
@@ -0,0 +1,308 @@
+#ifndef __CPURENDERER_HPP
+#define __CPURENDERER_HPP
+
+#include "types.hpp"
+#include "Camera.hpp"
+#include "Scene.hpp"
+#include "Timer/Timer.hpp"
+#include "Morton.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// CPU port of main() and colorFromRay() from VoxelShaderFrag.glsl, writing
+// into plain arrays instead of a framebuffer. Pixel (x, y) is the fragment at
+// gl_FragCoord (x + 0.5, y + 0.5), so row 0 is the bottom of the screen.
+//
+// With useReprojection set, primary rays start at a distance taken from the
+// previous frame instead of at the camera. Last frame's hit points are moved
+// into the new view, keeping the nearest one per pixel, and each pixel starts
+// a little in front of the nearest of those in its 3x3 neighbourhood. If any
+// pixel of the neighbourhood got nothing (a disocclusion, the screen edge or
+// the sky) the ray starts at the camera as usual.
+//
+// Secondary rays, the sun shadow ray and aoSamples ambient occlusion rays per
+// hit, aren't traced right after their primary ray but gathered into one batch
+// for the whole frame. With sortSecondaryRays set the batch is sorted by a
+// direction bucket and then the Morton code of the ray origin before tracing,
+// so rays that are traced one after the other visit mostly the same nodes.
+class CpuRenderer {
+public:
+        static constexpr float NO_SAMPLE = std::numeric_limits<float>::infinity();
+        // How far in front of the reprojected distance a ray starts.
+        static constexpr float REPROJECTION_MARGIN = 1.0f / 512.0f;
+        static constexpr float REPROJECTION_RELATIVE_MARGIN = 0.01f;
+        // Bits per axis of the ray origins' Morton codes.
+        static constexpr uint SORT_BITS = 10;
+
+        struct FrameStats {
+                uint64 primaryRays = 0;
+                uint64 primarySteps = 0;
+                uint64 primaryFetches = 0;
+                uint64 primaryHits = 0;
+                uint64 attributeFetches = 0;
+                uint64 reprojectedRays = 0;
+                uint64 secondaryRays = 0;
+                uint64 secondarySteps = 0;
+                uint64 secondaryFetches = 0;
+                Clock::duration sortTime = Clock::duration::zero();
+                Clock::duration secondaryTime = Clock::duration::zero(); // Including the sort.
+                Clock::duration time = Clock::duration::zero();
+        };
+
+        uint width;
+        uint height;
+        bool useReprojection = false;
+        bool sortSecondaryRays = false;
+        uint aoSamples = 0;
+        float aoRadius = 1.0f / 32.0f; // In world units.
+        std::vector<glm::vec4> colors;
+        std::vector<float> hitTs; // Primary hit distance, -1 on a miss.
+
+        CpuRenderer(uint width, uint height):
+                width(width), height(height),
+                colors(width * height), hitTs(width * height, -1.0f), startTs(width * height), surfaces(width * height) {}
+
+        static glm::vec2 getScreenPos(uint x, uint y, uint width, uint height) {
+                return glm::vec2((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+        }
+        glm::vec2 getScreenPos(uint x, uint y) const {
+                return getScreenPos(x, y, width, height);
+        }
+
+        // Takes effect from the next frame on, which still reprojects the hits
+        // of the previous frame at their old resolution.
+        void setResolution(uint newWidth, uint newHeight) {
+                width = newWidth;
+                height = newHeight;
+                colors.resize(width * height);
+                startTs.resize(width * height);
+                surfaces.resize(width * height);
+        }
+
+        FrameStats render(const Scene& scene, const Camera& camera) {
+                Timer timer;
+                FrameStats stats;
+                bool reproject = useReprojection && hasPrevFrame;
+                if (reproject) { reprojectHits(camera); }
+                hitTs.resize(width * height);
+
+                secondaryRays.clear();
+                for (uint y = 0; y < height; y++) {
+                        for (uint x = 0; x < width; x++) {
+                                float tmin = reproject ? getStartT(x, y) : 0.0f;
+                                stats.reprojectedRays += tmin > 0.0f;
+                                uint i = y * width + x;
+                                castPrimaryRay(scene, camera.position, camera.getRayDir(getScreenPos(x, y)), tmin, i, stats);
+                        }
+                }
+
+                Timer secondaryTimer;
+                if (sortSecondaryRays) {
+                        Timer sortTimer;
+                        sortRays(scene);
+                        stats.sortTime = sortTimer.elapsed();
+                }
+                for (uint rayIdx = 0; rayIdx < secondaryRays.size(); rayIdx++) {
+                        auto& ray = secondaryRays[sortSecondaryRays ? rayOrder[rayIdx].second : rayIdx];
+                        auto hit = scene.raycast(ray.origin, ray.dir, 0.0f, ray.tlimit);
+                        stats.secondaryRays++;
+                        stats.secondarySteps += hit.steps;
+                        stats.secondaryFetches += hit.fetches;
+                        Surface& surface = surfaces[ray.pixel];
+                        if (ray.isShadow) {
+                                surface.lit = hit.t == -1.0f ? 1.0f : glm::clamp(hit.t, 0.0f, 1.0f);
+                        }
+                        else {
+                                surface.unoccluded += hit.t == -1.0f;
+                        }
+                }
+                stats.secondaryTime = secondaryTimer.elapsed();
+
+                for (uint i = 0; i < width * height; i++) {
+                        colors[i] = shade(surfaces[i]);
+                }
+
+                prevCamera = camera;
+                prevWidth = width;
+                prevHeight = height;
+                hasPrevFrame = true;
+                stats.time = timer.elapsed();
+                return stats;
+        }
+
+        // Bilinear upscale of colors to outWidth x outHeight, like the
+        // GL_LINEAR blit VoxelRenderer finishes a scaled frame with.
+        void upscale(uint outWidth, uint outHeight, std::vector<glm::vec4>& out) const {
+                out.resize(outWidth * outHeight);
+                for (uint y = 0; y < outHeight; y++) {
+                        float sy = std::min(std::max((y + 0.5f) * height / outHeight - 0.5f, 0.0f), height - 1.0f);
+                        uint y0 = sy;
+                        uint y1 = std::min(y0 + 1, height - 1);
+                        for (uint x = 0; x < outWidth; x++) {
+                                float sx = std::min(std::max((x + 0.5f) * width / outWidth - 0.5f, 0.0f), width - 1.0f);
+                                uint x0 = sx;
+                                uint x1 = std::min(x0 + 1, width - 1);
+                                auto top = glm::mix(colors[y0 * width + x0], colors[y0 * width + x1], sx - x0);
+                                auto bottom = glm::mix(colors[y1 * width + x0], colors[y1 * width + x1], sx - x0);
+                                out[y * outWidth + x] = glm::mix(top, bottom, sy - y0);
+                        }
+                }
+        }
+
+        // Call when the view jumps or the scene changes.
+        void resetHistory() { hasPrevFrame = false; }
+
+private:
+        std::vector<float> startTs;
+        Camera prevCamera = Camera::create();
+        uint prevWidth = 0;
+        uint prevHeight = 0;
+        bool hasPrevFrame = false;
+
+        // What the primary pass found at a pixel, completed by its secondary rays.
+        struct Surface {
+                bool isHit;
+                glm::vec3 baseColor;
+                float lit;
+                uint unoccluded; // AO rays that escaped.
+        };
+
+        struct SecondaryRay {
+                glm::vec3 origin;
+                glm::vec3 dir;
+                float tlimit;
+                uint pixel;
+                bool isShadow;
+        };
+
+        std::vector<Surface> surfaces;
+        std::vector<SecondaryRay> secondaryRays;
+        std::vector<std::pair<uint64, uint>> rayOrder; // Sort key and index into secondaryRays.
+
+        static glm::vec3 getSunDir() {
+                return glm::normalize(glm::vec3(0.5f, 0.5f, 0.5f));
+        }
+
+        // The primary half of colorFromRay() in VoxelShaderFrag.glsl. The
+        // secondary rays of a hit are added to the batch.
+        void castPrimaryRay(const Scene& scene, glm::vec3 p, glm::vec3 d, float tmin, uint pixel, FrameStats& stats) {
+                auto hit = scene.raycast(p, d, tmin);
+                stats.primaryRays++;
+                stats.primarySteps += hit.steps;
+                stats.primaryFetches += hit.fetches;
+                hitTs[pixel] = hit.t;
+                Surface& surface = surfaces[pixel];
+                surface.isHit = hit.t != -1.0f;
+                if (!surface.isHit) { return; }
+                stats.primaryHits++;
+
+                // The attribute pointer, then the palette index and the palette
+                // entry if there is one.
+                uint32 attribute = scene.getAttribute(hit);
+                stats.attributeFetches += scene.attributes.ptrs[hit.nodeIdx].attributeIdx == VoxelAttributes::NONE ? 1 : 3;
+                surface.baseColor = glm::vec3(attribute & 0xFF, attribute >> 8 & 0xFF, attribute >> 16 & 0xFF) / 255.0f;
+                surface.lit = 1.0f;
+                surface.unoccluded = 0;
+
+                auto sunDir = getSunDir();
+                auto rayEnd = p + d * hit.t;
+                secondaryRays.push_back({rayEnd + sunDir * std::exp2(-20.0f), sunDir,
+                                         std::numeric_limits<float>::infinity(), pixel, true});
+
+                // Cosine weighted directions around the normal, the same ones
+                // every frame so that a still image doesn't flicker.
+                auto tangent = glm::normalize(glm::cross(hit.normal, std::abs(hit.normal.x) < 0.5f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f)));
+                auto bitangent = glm::cross(hit.normal, tangent);
+                for (uint sample = 0; sample < aoSamples; sample++) {
+                        float u = hashToUnit(pixel * 2 * aoSamples + sample * 2);
+                        float v = hashToUnit(pixel * 2 * aoSamples + sample * 2 + 1);
+                        float r = std::sqrt(u);
+                        float phi = 2.0f * float(M_PI) * v;
+                        auto dir = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + hit.normal * std::sqrt(1.0f - u);
+                        secondaryRays.push_back({rayEnd + hit.normal * std::exp2(-20.0f), dir, aoRadius, pixel, false});
+                }
+        }
+
+        glm::vec4 shade(const Surface& surface) const {
+                auto sunColor = glm::vec3(1.0f, 0.97f, 0.87f);
+                auto ambientColor = glm::vec3(0.1f, 0.2f, 0.3f);
+                auto skyColor = glm::vec3(0.3f, 0.6f, 0.8f);
+
+                if (!surface.isHit) { return glm::vec4(skyColor, 1.0f); }
+                if (aoSamples > 0) { ambientColor *= float(surface.unoccluded) / aoSamples; }
+                return glm::vec4(glm::mix(ambientColor, sunColor, surface.lit) * surface.baseColor, 1.0f);
+        }
+
+        // Rays are grouped by the octant of their direction and its major
+        // axis, and ordered along a Z-curve through the scene bounds within
+        // each group.
+        void sortRays(const Scene& scene) {
+                rayOrder.resize(secondaryRays.size());
+                if (scene.bvh.empty()) { return; }
+                auto& bounds = scene.bvh[0].bounds;
+                auto cells = glm::vec3(float(1 << SORT_BITS)) / glm::max(bounds.max - bounds.min, glm::vec3(1e-20f));
+                for (uint rayIdx = 0; rayIdx < secondaryRays.size(); rayIdx++) {
+                        auto& ray = secondaryRays[rayIdx];
+                        auto cell = glm::clamp((ray.origin - bounds.min) * cells, 0.0f, float((1 << SORT_BITS) - 1));
+                        auto absDir = glm::abs(ray.dir);
+                        uint majorAxis = absDir.x >= absDir.y && absDir.x >= absDir.z ? 0 : absDir.y >= absDir.z ? 1 : 2;
+                        uint octant = (ray.dir.x < 0.0f) | (ray.dir.y < 0.0f) << 1 | (ray.dir.z < 0.0f) << 2;
+                        uint64 bucket = octant << 2 | majorAxis;
+                        rayOrder[rayIdx] = {bucket << (3 * SORT_BITS) | Morton::encode(cell.x, cell.y, cell.z), rayIdx};
+                }
+                std::sort(rayOrder.begin(), rayOrder.end());
+        }
+
+        // Uniform float in [0, 1) from an integer.
+        static float hashToUnit(uint32 x) {
+                x ^= x >> 16;
+                x *= 0x7feb352d;
+                x ^= x >> 15;
+                x *= 0x846ca68b;
+                x ^= x >> 16;
+                return (x >> 8) * (1.0f / 16777216.0f);
+        }
+
+        // Splats every hit of the previous frame into the pixel it lands in
+        // now, keeping the nearest distance from the new camera.
+        void reprojectHits(const Camera& camera) {
+                std::fill(startTs.begin(), startTs.end(), NO_SAMPLE);
+                for (uint y = 0; y < prevHeight; y++) {
+                        for (uint x = 0; x < prevWidth; x++) {
+                                float t = hitTs[y * prevWidth + x];
+                                if (t < 0.0f) { continue; }
+                                auto screenDir = prevCamera.getRayDir(getScreenPos(x, y, prevWidth, prevHeight));
+                                auto point = prevCamera.position + screenDir * t;
+                                glm::vec2 screenPos;
+                                if (!camera.project(point, screenPos)) { continue; }
+                                int px = std::floor((screenPos.x + 1.0f) * 0.5f * width);
+                                int py = std::floor((screenPos.y + 1.0f) * 0.5f * height);
+                                if (px < 0 || py < 0 || px >= int(width) || py >= int(height)) { continue; }
+                                float& startT = startTs[py * width + px];
+                                startT = std::min(startT, glm::length(point - camera.position));
+                        }
+                }
+        }
+
+        float getStartT(uint x, uint y) const {
+                float nearest = NO_SAMPLE;
+                for (int dy = -1; dy <= 1; dy++) {
+                        for (int dx = -1; dx <= 1; dx++) {
+                                // Geometry can come in from past the edge of the screen.
+                                int nx = int(x) + dx;
+                                int ny = int(y) + dy;
+                                if (nx < 0 || ny < 0 || nx >= int(width) || ny >= int(height)) { return 0.0f; }
+                                float t = startTs[ny * width + nx];
+                                if (t == NO_SAMPLE) { return 0.0f; }
+                                nearest = std::min(nearest, t);
+                        }
+                }
+                return std::max(0.0f, nearest * (1.0f - REPROJECTION_RELATIVE_MARGIN) - REPROJECTION_MARGIN);
+        }
+};
+
+#endif //__CPURENDERER_HPP
@@ -0,0 +1,93 @@
+#ifndef __FRAMEGOVERNOR_HPP
+#define __FRAMEGOVERNOR_HPP
+
+#include "types.hpp"
+#include "Timer/Timer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+// Picks the resolution scale frames are ray cast at so that render time stays
+// under a target. Render time is taken to grow with the number of pixels, so
+// every measurement gives the time a full resolution frame would take; the
+// next scale is the largest multiple of SCALE_STEP predicted to fit. Scaling
+// down happens as soon as a frame is over the target, scaling up only once the
+// larger size would still leave HEADROOM spare, which keeps the scale from
+// flickering between two steps.
+//
+// Nothing here knows about GL: feed it the measured time of every frame along
+// with the scale that frame was rendered at, GPU timer queries or CPU timings
+// alike.
+class FrameGovernor {
+public:
+        static constexpr float SCALE_STEP = 1.0f / 16.0f;
+        static constexpr float SMOOTHING = 0.25f; // Weight of the newest measurement.
+        static constexpr float HEADROOM = 0.15f;
+        static constexpr uint HISTORY_SIZE = 240;
+
+        struct Decision {
+                uint64 frame;
+                float scale; // What the frame was rendered at.
+                Clock::duration renderTime;
+                Clock::duration fullFrameEstimate;
+                float nextScale;
+        };
+
+        FrameGovernor(Clock::duration target, float minScale = 0.25f, float maxScale = 1.0f):
+                target(target), minScale(minScale), maxScale(maxScale), scale(maxScale) {}
+
+        Clock::duration getTarget() const { return target; }
+        void setTarget(Clock::duration newTarget) { target = newTarget; }
+
+        float getScale() const { return scale; }
+
+        // Size of the render target for a full resolution size.
+        uint getScaled(uint fullSize) const {
+                return std::max(1u, uint(fullSize * scale + 0.5f));
+        }
+
+        const Decision& update(float renderedScale, Clock::duration renderTime) {
+                float seconds = std::chrono::duration<float>(renderTime).count();
+                float cost = seconds / (renderedScale * renderedScale);
+                estimate = frameCount == 0 ? cost : estimate + (cost - estimate) * SMOOTHING;
+                // Trust a sudden slowdown right away rather than averaging it in.
+                float fullCost = std::max(estimate, cost);
+
+                float targetSeconds = std::chrono::duration<float>(target).count();
+                float nextScale = scale;
+                if (fullCost * scale * scale > targetSeconds) {
+                        nextScale = getFittingScale(fullCost, targetSeconds);
+                }
+                else if (fullCost * (scale + SCALE_STEP) * (scale + SCALE_STEP) <= targetSeconds * (1.0f - HEADROOM)) {
+                        nextScale = getFittingScale(fullCost, targetSeconds * (1.0f - HEADROOM));
+                }
+
+                history.push_back({
+                        frameCount++, renderedScale, renderTime,
+                        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(fullCost)),
+                        nextScale
+                });
+                if (history.size() > HISTORY_SIZE) { history.pop_front(); }
+                scale = nextScale;
+                return history.back();
+        }
+
+        // The last HISTORY_SIZE decisions, oldest first.
+        const std::deque<Decision>& getHistory() const { return history; }
+
+private:
+        Clock::duration target;
+        float minScale;
+        float maxScale;
+        float scale;
+        float estimate = 0.0f;
+        uint64 frameCount = 0;
+        std::deque<Decision> history;
+
+        float getFittingScale(float fullCost, float budget) const {
+                float fitting = std::floor(std::sqrt(budget / fullCost) / SCALE_STEP) * SCALE_STEP;
+                return std::min(std::max(fitting, minScale), maxScale);
+        }
+};
+
+#endif //__FRAMEGOVERNOR_HPP
@@ -1,3 +1,6 @@
+#ifndef __FUNC_HPP
+#define __FUNC_HPP
+
 #include <iterator>
 template<typename IterT, typename F>
 class FilterIterRange {
@@ -114,3 +117,5 @@ template<typename T>
 RangeIterRange<T> range(T start, T stop) {
         return RangeIterRange<T>{start, stop};
 }
+
+#endif //__FUNC_HPP
@@ -2,3 +2,4 @@
 #include "GLLib/Program.hpp"
 #include "GLLib/Window.hpp"
 #include "GLLib/VertexArray.hpp"
+#include "GLLib/ProgramCache.hpp"
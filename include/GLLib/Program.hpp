@@ -1,6 +1,7 @@
 #include <GL/glew.h>
 #include "GLLib/Shader.hpp"
 #include <iostream>
+#include <vector>
 
 namespace GLLib {
 
@@ -50,6 +51,27 @@ public:
         }
         void use() { glUseProgram(id); }
 
+        // Must be called before link() for getBinary() to be allowed to
+        // return anything.
+        void setBinaryRetrievable() {
+                glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+
+        std::vector<char> getBinary(GLenum& format) {
+                std::vector<char> binary(getInt(GL_PROGRAM_BINARY_LENGTH));
+                GLsizei length = 0;
+                glGetProgramBinary(id, binary.size(), &length, &format, binary.data());
+                binary.resize(length);
+                return binary;
+        }
+
+        // Returns false if the driver rejects the binary, in which case the
+        // program can still be built from source as usual.
+        bool loadBinary(GLenum format, const std::vector<char>& binary) {
+                glProgramBinary(id, format, binary.data(), binary.size());
+                return getInt(GL_LINK_STATUS);
+        }
+
         auto getUniformLoc(const char* name) { return glGetUniformLocation(id, name); }
 };
 
@@ -0,0 +1,81 @@
+#include <GL/glew.h>
+#include "types.hpp"
+#include <cstdio>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace GLLib {
+
+// Caches linked program binaries on disk. Entries are keyed by the driver
+// strings and the shader sources, so a driver update or a shader edit just
+// misses the cache and the caller falls back to compiling from source.
+class ProgramCache {
+private:
+        static constexpr uint32 magic = 0x4E494250; // "PBIN"
+        std::string directory;
+
+        static uint64 hash(uint64 h, const char* str) {
+                for (; str && *str; ++str) {
+                        h ^= uint8(*str);
+                        h *= 0x100000001b3ull;
+                }
+                return h;
+        }
+
+        std::string getPath(uint64 key) const {
+                char name[32];
+                snprintf(name, sizeof(name), "program-%016llx.bin", key);
+                return directory + "/" + name;
+        }
+public:
+        ProgramCache(std::string directory): directory(directory) {}
+
+        static bool isSupported() {
+                GLint numFormats = 0;
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+                return numFormats > 0;
+        }
+
+        static uint64 getKey(std::initializer_list<const char*> sources) {
+                uint64 h = 0xcbf29ce484222325ull;
+                for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+                        h = hash(h, (const char*)glGetString(name));
+                }
+                for (auto source : sources) {
+                        h = hash(h, source);
+                }
+                return h;
+        }
+
+        bool load(Program& program, uint64 key) const {
+                if (!isSupported()) { return false; }
+                std::ifstream in(getPath(key), std::ios::in | std::ios::binary);
+                uint32 header[2] = {0};
+                uint64 storedKey = 0;
+                in.read((char*)header, sizeof(header));
+                in.read((char*)&storedKey, sizeof(storedKey));
+                if (!in || header[0] != magic || storedKey != key) { return false; }
+
+                GLenum format = header[1];
+                std::vector<char> binary{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+                return program.loadBinary(format, binary);
+        }
+
+        void store(Program& program, uint64 key) const {
+                if (!isSupported()) { return; }
+                GLenum format = 0;
+                auto binary = program.getBinary(format);
+                if (binary.empty()) { return; }
+
+                std::ofstream out(getPath(key), std::ios::out | std::ios::binary);
+                uint32 header[2] = {magic, format};
+                out.write((const char*)header, sizeof(header));
+                out.write((const char*)&key, sizeof(key));
+                out.write(binary.data(), binary.size());
+        }
+};
+
+};
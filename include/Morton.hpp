@@ -42,6 +42,20 @@ uint encode2(uint x, uint y) {
         return interleave2(x) | (interleave2(y) << 1);
 }
 
+// Inverse of deinterleave(), for the low 10 bits of x.
+uint interleave(uint x) {
+        x &= 0x000003FF;
+        x = (x | x << 16) & 0x030000FF;
+        x = (x | x << 8) & 0x0300F00F;
+        x = (x | x << 4) & 0x030C30C3;
+        x = (x | x << 2) & 0x09249249;
+        return x;
+}
+
+uint encode(uint x, uint y, uint z) {
+        return interleave(x) | (interleave(y) << 1) | (interleave(z) << 2);
+}
+
 }
 
 #endif //__MORTON_HPP
@@ -0,0 +1,551 @@
+#ifndef __OCTREEARCHIVE_HPP
+#define __OCTREEARCHIVE_HPP
+
+#include "types.hpp"
+#include "Func/Func.hpp"
+#include "VoxelOctree.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// Compressed on-disk container for a VoxelOctree.
+//
+// Every node is stored as its validMask, one leaf bit per valid child, a flag
+// followed by one brick bit per invalid child if it has any bricks, and a
+// far-pointer bit, packed LSB first into a bit stream. Bricks are stored as
+// their raw 64-bit mask where they appear among the children. Child pointers are not
+// stored at all: they are rebuilt from the order the nodes appear in, which is
+// the order VoxelOctree::addSubtree() lays them out in. The tree is cut at
+// blockDepth; the levels above it go into a small top stream and the
+// descendants of every node at blockDepth go into their own block. Each block
+// records where its nodes land in the final array, so the top stream and all
+// blocks can be decoded in parallel straight into VoxelOctree::nodes.
+//
+// Attributes are stored with the entries they belong to, right after every
+// node with solid children and every brick: see writeAttributes(). Where
+// they land in VoxelAttributes::indices follows from the order the entries
+// are decoded in, and every block records where its indices start. Only the
+// palettes are stored as they are, after the blocks.
+
+class BitWriter {
+private:
+        std::vector<uint8>& out;
+        uint64 buffer = 0;
+        uint count = 0;
+public:
+        BitWriter(std::vector<uint8>& out): out(out) {}
+
+        void write(uint value, uint numBits) {
+                buffer |= (value & ((uint64(1) << numBits) - 1)) << count;
+                count += numBits;
+                while (count >= 8) {
+                        out.push_back(buffer & 0xFF);
+                        buffer >>= 8;
+                        count -= 8;
+                }
+        }
+
+        void flush() {
+                if (count > 0) { out.push_back(buffer & 0xFF); }
+                buffer = 0;
+                count = 0;
+        }
+};
+
+class BitReader {
+private:
+        const uint8* curr;
+        const uint8* end;
+        uint64 buffer = 0;
+        uint count = 0;
+public:
+        BitReader(const uint8* start, const uint8* end): curr(start), end(end) {}
+
+        uint read(uint numBits) {
+                if (count < numBits) {
+                        // Top the buffer up to at least 32 bits in one go.
+                        if (end - curr >= 4) {
+                                uint32 word;
+                                std::memcpy(&word, curr, sizeof(word));
+                                buffer |= uint64(word) << count;
+                                curr += 4;
+                                count += 32;
+                        }
+                        else {
+                                while (count < numBits) {
+                                        if (curr == end) { throw std::runtime_error("octree archive block overrun"); }
+                                        buffer |= uint64(*curr++) << count;
+                                        count += 8;
+                                }
+                        }
+                }
+                uint value = buffer & ((uint64(1) << numBits) - 1);
+                buffer >>= numBits;
+                count -= numBits;
+                return value;
+        }
+};
+
+struct OctreeArchive {
+        static constexpr uint32 magic = 0x5A584F56; // "VOXZ"
+        static constexpr uint32 version = 4;
+        // Limits read() checks before allocating anything. Every entry takes
+        // at most 32 bits in the streams, which are padded to whole bytes,
+        // plus less than 14 bytes of attributes for a node and 70 for a brick,
+        // which takes two entries. An entry has at most 64 attribute indices
+        // and reaches at most MAX_PALETTE_SIZE palette entries. maxDepth is
+        // the traversal's stack size.
+        static constexpr uint32 maxNodeCount = 1u << 28;
+        static constexpr uint32 maxEntryBytes = 4 + 35;
+        static constexpr uint32 maxDepth = 23;
+
+        // rootNode is the node the block holds the descendants of.
+        struct Block {
+                uint32 nodeStart;
+                uint32 nodeCount;
+                uint32 byteStart;
+                uint32 byteCount;
+                uint32 rootNode;
+                uint32 indexStart;
+                uint32 indexCount;
+        };
+
+        uint32 blockDepth = 0;
+        uint32 nodeCount = 0;
+        uint32 rootNode = 0;
+        uint32 hasAttributes = 0;
+        uint32 indexCount = 0;
+        Block top = {0, 0, 0, 0, 0, 0, 0};
+        std::vector<Block> blocks;
+        std::vector<uint8> data;
+        std::vector<uint32> palettes;
+
+        uint64 rawBytes() const {
+                uint64 attributeBytes = uint64(nodeCount) * sizeof(VoxelAttributes::Ptr) + indexCount + palettes.size() * sizeof(uint32);
+                return uint64(nodeCount) * sizeof(NodeOrFarPtr) + (hasAttributes ? attributeBytes : 0);
+        }
+        uint64 compressedBytes() const {
+                return sizeof(uint32) * 9 + sizeof(Block) * (blocks.size() + 1) + data.size() + palettes.size() * sizeof(uint32);
+        }
+        float compressionRatio() const { return float(rawBytes()) / compressedBytes(); }
+
+        static OctreeArchive compress(const VoxelOctree& oct, uint blockDepth = 3) {
+                OctreeArchive self;
+                self.blockDepth = blockDepth;
+                self.nodeCount = oct.nodes.size();
+                self.rootNode = oct.nodes[0].farptr;
+                self.hasAttributes = !oct.attributes.ptrs.empty();
+                if (self.hasAttributes) { self.palettes = oct.attributes.palettes; }
+
+                std::vector<uint8> topData;
+                Stream topStream{{topData}, 0, 0};
+                const VoxelNode& root = oct.nodes[0].node;
+                self.writeAttributes(oct, 0, popCount(root.validMask & root.leafMask), topStream);
+                self.encodeSubtree(oct, 0, 0, topStream);
+                topStream.bits.flush();
+
+                // The indices of the blocks come first, then those of the top
+                // stream.
+                for (Block& block : self.blocks) {
+                        block.indexStart = self.indexCount;
+                        self.indexCount += block.indexCount;
+                }
+                self.top = {1, self.nodeCount - 1, uint32(self.data.size()), uint32(topData.size()), self.rootNode,
+                            self.indexCount, topStream.indexCount};
+                self.indexCount += topStream.indexCount;
+                self.data.insert(self.data.end(), topData.begin(), topData.end());
+                return self;
+        }
+
+        VoxelOctree decompress(uint numThreads = 0) const {
+                VoxelOctree oct;
+                oct.nodes.resize(nodeCount);
+                oct.nodes[0].farptr = rootNode;
+                if (hasAttributes) {
+                        oct.attributes.ptrs.resize(nodeCount, {VoxelAttributes::NONE, 0});
+                        oct.attributes.indices.resize(indexCount);
+                        oct.attributes.palettes = palettes;
+                }
+
+                if (numThreads == 0) { numThreads = std::thread::hardware_concurrency(); }
+                if (numThreads == 0) { numThreads = 1; }
+                if (numThreads > blocks.size() + 1) { numThreads = blocks.size() + 1; }
+
+                // Item 0 is the top stream, item i > 0 is blocks[i - 1]. The
+                // first error stops the other workers and is rethrown here.
+                std::atomic<uint> nextItem{0};
+                std::exception_ptr error;
+                std::mutex errorMutex;
+                auto worker = [&]() {
+                        try {
+                                for (uint item = nextItem++; item <= blocks.size(); item = nextItem++) {
+                                        const Block& block = item == 0 ? top : blocks[item - 1];
+                                        decodeBlock(block, item == 0, oct);
+                                }
+                        }
+                        catch (...) {
+                                std::lock_guard<std::mutex> lock(errorMutex);
+                                if (!error) { error = std::current_exception(); }
+                                nextItem = blocks.size() + 1;
+                        }
+                };
+
+                std::vector<std::thread> threads;
+                for (uint i = 1; i < numThreads; i++) { threads.emplace_back(worker); }
+                worker();
+                for (auto& thread : threads) { thread.join(); }
+                if (error) { std::rethrow_exception(error); }
+
+                return oct;
+        }
+
+        void write(std::ostream& out) const {
+                auto put = [&](uint32 x) { out.write((const char*)&x, sizeof(x)); };
+                put(magic);
+                put(version);
+                put(blockDepth);
+                put(nodeCount);
+                put(rootNode);
+                put(blocks.size());
+                put(hasAttributes);
+                put(indexCount);
+                put(palettes.size());
+                out.write((const char*)&top, sizeof(Block));
+                out.write((const char*)blocks.data(), blocks.size() * sizeof(Block));
+                out.write((const char*)data.data(), data.size());
+                out.write((const char*)palettes.data(), palettes.size() * sizeof(uint32));
+                if (!out) { throw std::runtime_error("failed to write octree archive"); }
+        }
+
+        static OctreeArchive read(std::istream& in) {
+                auto get = [&]() { uint32 x = 0; in.read((char*)&x, sizeof(x)); return x; };
+                if (get() != magic) { throw std::runtime_error("not an octree archive"); }
+                if (get() != version) { throw std::runtime_error("unsupported octree archive version"); }
+
+                OctreeArchive self;
+                self.blockDepth = get();
+                self.nodeCount = get();
+                self.rootNode = get();
+                uint32 blockCount = get();
+                self.hasAttributes = get();
+                self.indexCount = get();
+                uint32 paletteCount = get();
+                in.read((char*)&self.top, sizeof(Block));
+                if (!in) { throw std::runtime_error("truncated octree archive"); }
+
+                // Every block holds the descendants of a distinct node.
+                if (self.nodeCount == 0 || self.nodeCount > maxNodeCount || self.blockDepth > maxDepth
+                    || blockCount >= self.nodeCount) {
+                        throw std::runtime_error("corrupt octree archive header");
+                }
+                if (self.hasAttributes > 1 || (!self.hasAttributes && (self.indexCount != 0 || paletteCount != 0))
+                    || self.indexCount > uint64(self.nodeCount) * 64
+                    || paletteCount > uint64(self.nodeCount) * PreVoxelOctree::MAX_PALETTE_SIZE) {
+                        throw std::runtime_error("corrupt octree archive header");
+                }
+                // The root's children follow it.
+                NodeOrFarPtr root;
+                root.farptr = self.rootNode;
+                uint64 dataSize = uint64(self.top.byteStart) + self.top.byteCount;
+                uint64 entryBytes = self.hasAttributes ? maxEntryBytes : sizeof(NodeOrFarPtr);
+                if (root.node.getChildPtr() != 1 || root.node.isFar() || dataSize > self.nodeCount * entryBytes + blockCount + 1
+                    || !self.isValidBlock(self.top, dataSize) || self.top.nodeStart != 1 || self.top.rootNode != self.rootNode) {
+                        throw std::runtime_error("corrupt octree archive header");
+                }
+
+                self.blocks.resize(blockCount);
+                in.read((char*)self.blocks.data(), self.blocks.size() * sizeof(Block));
+                uint64 blocksEnd = 0;
+                uint64 indicesEnd = 0;
+                for (const Block& block : self.blocks) {
+                        if (!self.isValidBlock(block, dataSize) || block.nodeStart < blocksEnd || block.indexStart < indicesEnd) {
+                                throw std::runtime_error("corrupt octree archive block table");
+                        }
+                        blocksEnd = uint64(block.nodeStart) + block.nodeCount;
+                        indicesEnd = uint64(block.indexStart) + block.indexCount;
+                }
+                if (self.top.indexStart < indicesEnd) { throw std::runtime_error("corrupt octree archive block table"); }
+
+                self.data.resize(dataSize);
+                in.read((char*)self.data.data(), dataSize);
+                self.palettes.resize(paletteCount);
+                in.read((char*)self.palettes.data(), paletteCount * sizeof(uint32));
+                if (!in) { throw std::runtime_error("truncated octree archive"); }
+                return self;
+        }
+
+private:
+        // Whether a block's nodes lie within the node array, after the root,
+        // and its bytes and indices within the data and the indices.
+        bool isValidBlock(const Block& block, uint64 dataSize) const {
+                return block.nodeStart >= 1 && uint64(block.nodeStart) + block.nodeCount <= nodeCount
+                    && uint64(block.byteStart) + block.byteCount <= dataSize
+                    && uint64(block.indexStart) + block.indexCount <= indexCount;
+        }
+
+        // The top stream or a block being written, with the number of
+        // palette indices in it so far and the palette of the last entry
+        // that had attributes.
+        struct Stream {
+                BitWriter bits;
+                uint32 indexCount;
+                uint32 paletteIdx;
+        };
+
+        static uint bitWidth(uint x) {
+                return x == 0 ? 0 : 32 - __builtin_clz(x);
+        }
+
+        // The attributes of an entry with count of them: a bit for whether
+        // it has any, then a bit for whether its palette is the one of the
+        // entry before, followed by the palette if not. Then its indices as
+        // the smallest one and the difference of each to it, at the width
+        // the largest difference needs.
+        void writeAttributes(const VoxelOctree& oct, uint entryIdx, uint count, Stream& stream) const {
+                if (!hasAttributes || count == 0) { return; }
+                const VoxelAttributes::Ptr& ptr = oct.attributes.ptrs[entryIdx];
+                auto& bits = stream.bits;
+                bits.write(ptr.attributeIdx != VoxelAttributes::NONE, 1);
+                if (ptr.attributeIdx == VoxelAttributes::NONE) { return; }
+                bits.write(ptr.paletteIdx == stream.paletteIdx, 1);
+                if (ptr.paletteIdx != stream.paletteIdx) {
+                        bits.write(ptr.paletteIdx, 32);
+                        stream.paletteIdx = ptr.paletteIdx;
+                }
+
+                auto begin = oct.attributes.indices.begin() + ptr.attributeIdx;
+                auto minMax = std::minmax_element(begin, begin + count);
+                uint base = *minMax.first;
+                uint width = bitWidth(*minMax.second - base);
+                bits.write(base, 8);
+                bits.write(width, 4);
+                for (auto index = begin; index != begin + count; ++index) { bits.write(*index - base, width); }
+                stream.indexCount += count;
+        }
+
+        // Mirrors the three passes of VoxelOctree::addSubtree(): write the
+        // children, then the far pointer slots, then recurse into each node.
+        void encodeSubtree(const VoxelOctree& oct, uint nodeIdx, uint depth, Stream& stream) {
+                auto& bits = stream.bits;
+                const VoxelNode& node = oct.nodes[nodeIdx].node;
+                auto validNonLeaves = node.getValidNonLeaves();
+                auto nodeChildren = node.getNodeMask();
+                auto isValidNonLeaf = [&](auto i) -> bool { return validNonLeaves & 1 << i; };
+                auto isNodeChild = [&](auto i) -> bool { return nodeChildren & 1 << i; };
+
+                for (int i : filter(isValidNonLeaf, range(0,8))) {
+                        uint childIdx = oct.getChildIdx(nodeIdx, i);
+                        if (!isNodeChild(i)) {
+                                bits.write(oct.nodes[childIdx].farptr, 32);
+                                bits.write(oct.nodes[childIdx + 1].farptr, 32);
+                                writeAttributes(oct, childIdx, popCount64(oct.getBrick(childIdx)), stream);
+                                continue;
+                        }
+
+                        const VoxelNode& child = oct.nodes[childIdx].node;
+                        bits.write(child.validMask, 8);
+                        for (int j : range(0,8)) {
+                                if (child.validMask & 1 << j) { bits.write(child.leafMask >> j, 1); }
+                        }
+                        bits.write(child.getBrickMask() != 0, 1);
+                        if (child.getBrickMask() != 0) {
+                                for (int j : range(0,8)) {
+                                        if (~child.validMask & 1 << j) { bits.write(child.leafMask >> j, 1); }
+                                }
+                        }
+                        bits.write(child.isFar(), 1);
+                        writeAttributes(oct, childIdx, popCount(child.validMask & child.leafMask), stream);
+                }
+
+                for (int i : filter(isNodeChild, range(0,8))) {
+                        uint childIdx = oct.getChildIdx(nodeIdx, i);
+                        if (depth + 1 != blockDepth) {
+                                encodeSubtree(oct, childIdx, depth + 1, stream);
+                                continue;
+                        }
+
+                        std::vector<uint8> blockData;
+                        Stream blockStream{{blockData}, 0, 0};
+                        encodeSubtree(oct, childIdx, depth + 1, blockStream);
+                        blockStream.bits.flush();
+
+                        // compress() fills in indexStart.
+                        blocks.push_back({
+                                oct.getChildrenIdx(childIdx),
+                                oct.getSubtreeSize(childIdx),
+                                uint32(data.size()),
+                                uint32(blockData.size()),
+                                oct.nodes[childIdx].farptr,
+                                0,
+                                blockStream.indexCount
+                        });
+                        data.insert(data.end(), blockData.begin(), blockData.end());
+                }
+        }
+
+        // Scatters the low bits of value into the set bits of mask, lowest first.
+        // Branch free, since the masks are close to random.
+        static uint8 depositBits(uint value, uint8 mask) {
+                uint8 result = 0;
+                for (uint i = 0; i < 8; i++) {
+                        uint bit = mask >> i & 1;
+                        result |= (value & bit) << i;
+                        value >>= bit;
+                }
+                return result;
+        }
+
+        // Throws if the stream doesn't fit in [cursor, end) and its indices
+        // in [indexCursor, indexEnd) exactly, if the top stream doesn't agree
+        // with the blocks it skips over or if an index is outside the
+        // palettes. ptrs is null for an octree without attributes.
+        struct Decoder {
+                BitReader bits;
+                NodeOrFarPtr* nodes;
+                uint cursor;
+                uint end;
+                bool isTop;
+                uint blockDepth;
+                const Block* nextBlock;
+                const Block* blocksEnd;
+                VoxelAttributes::Ptr* ptrs;
+                uint8* indices;
+                uint indexCursor;
+                uint indexEnd;
+                uint32 paletteIdx;
+                uint32 paletteCount;
+
+                uint claim(uint count) {
+                        if (count > end - cursor) { throw std::runtime_error("octree archive block overruns its nodes"); }
+                        uint start = cursor;
+                        cursor += count;
+                        return start;
+                }
+
+                // See writeAttributes(). Entries without any stay NONE.
+                void readAttributes(uint entryIdx, uint count) {
+                        if (!ptrs || count == 0 || !bits.read(1)) { return; }
+                        if (!bits.read(1)) { paletteIdx = bits.read(32); }
+                        uint base = bits.read(8);
+                        uint width = bits.read(4);
+                        if (count > indexEnd - indexCursor || width > 8) {
+                                throw std::runtime_error("corrupt octree archive attributes");
+                        }
+
+                        uint maxIndex = 0;
+                        for (uint k = 0; k < count; k++) {
+                                uint index = base + bits.read(width);
+                                maxIndex = std::max(maxIndex, index);
+                                indices[indexCursor + k] = index;
+                        }
+                        if (maxIndex > 0xFF || uint64(paletteIdx) + maxIndex >= paletteCount) {
+                                throw std::runtime_error("corrupt octree archive attributes");
+                        }
+                        ptrs[entryIdx] = {indexCursor, paletteIdx};
+                        indexCursor += count;
+                }
+
+                static void setChildPtr(VoxelNode& node, uint offset, bool far) {
+                        if (offset > 0x7fff) { throw std::runtime_error("corrupt octree archive child pointer"); }
+                        node.setChildPtr(offset, far);
+                }
+
+                void decodeSubtree(VoxelNode parent, uint depth) {
+                        if (depth >= maxDepth) { throw std::runtime_error("octree archive too deep"); }
+                        uint startPos = cursor;
+                        auto brickChildren = parent.getBrickMask();
+                        auto nodeChildren = parent.getNodeMask();
+
+                        uint8 farMask = 0;
+                        for (uint8 children = parent.getValidNonLeaves(); children != 0; children &= children - 1) {
+                                uint8 child = children & -children;
+                                if (brickChildren & child) {
+                                        uint brickIdx = claim(2);
+                                        nodes[brickIdx].farptr = bits.read(32);
+                                        nodes[brickIdx + 1].farptr = bits.read(32);
+                                        readAttributes(brickIdx, popCount64(nodes[brickIdx].farptr | uint64(nodes[brickIdx + 1].farptr) << 32));
+                                        continue;
+                                }
+
+                                VoxelNode node;
+                                node.validMask = bits.read(8);
+                                auto numValid = popCount(node.validMask);
+                                uint leafAndBrickFlag = bits.read(numValid + 1);
+                                node.leafMask = depositBits(leafAndBrickFlag, node.validMask);
+                                if (leafAndBrickFlag >> numValid) {
+                                        node.leafMask |= depositBits(bits.read(8 - numValid), ~node.validMask);
+                                }
+                                if (bits.read(1)) { farMask |= child; }
+                                uint nodeIdx = claim(1);
+                                nodes[nodeIdx].node = node;
+                                readAttributes(nodeIdx, popCount(node.validMask & node.leafMask));
+                        }
+
+                        uint farPtrs[8] = {0};
+                        for (uint i = 0; i < 8; i++) {
+                                if (farMask & 1 << i) { farPtrs[i] = claim(1); }
+                        }
+
+                        for (uint i = 0; i < 8; i++) {
+                                if (!(nodeChildren & 1 << i)) { continue; }
+                                auto childIdx = startPos + parent.getChildOffset(i);
+                                auto& child = nodes[childIdx].node;
+
+                                if (farPtrs[i] == 0) {
+                                        setChildPtr(child, cursor - childIdx, false);
+                                }
+                                else {
+                                        setChildPtr(child, farPtrs[i] - childIdx, true);
+                                        nodes[farPtrs[i]].farptr = cursor - farPtrs[i];
+                                }
+
+                                if (isTop && depth + 1 == blockDepth) {
+                                        if (nextBlock == blocksEnd || nextBlock->nodeStart != cursor
+                                            || !sameMasks(child, nextBlock->rootNode)) {
+                                                throw std::runtime_error("octree archive blocks don't match its top stream");
+                                        }
+                                        claim(nextBlock->nodeCount);
+                                        ++nextBlock;
+                                }
+                                else {
+                                        decodeSubtree(child, depth + 1);
+                                }
+                        }
+                }
+
+                static bool sameMasks(VoxelNode node, uint32 rootNode) {
+                        NodeOrFarPtr root;
+                        root.farptr = rootNode;
+                        return node.validMask == root.node.validMask && node.leafMask == root.node.leafMask;
+                }
+        };
+
+        // Blocks start out at blockDepth, so the depth limit counts the levels
+        // above them too. The top stream starts with the attributes of the
+        // root.
+        void decodeBlock(const Block& block, bool isTop, VoxelOctree& oct) const {
+                const uint8* start = data.data() + block.byteStart;
+                const Block* blocksEnd = blocks.data() + blocks.size();
+                Decoder decoder{{start, start + block.byteCount}, oct.nodes.data(), block.nodeStart, block.nodeStart + block.nodeCount,
+                                isTop, blockDepth, blocks.data(), blocksEnd,
+                                hasAttributes ? oct.attributes.ptrs.data() : nullptr, oct.attributes.indices.data(),
+                                block.indexStart, block.indexStart + block.indexCount, 0, uint32(palettes.size())};
+                NodeOrFarPtr root;
+                root.farptr = block.rootNode;
+                if (isTop) { decoder.readAttributes(0, popCount(root.node.validMask & root.node.leafMask)); }
+                decoder.decodeSubtree(root.node, isTop ? 0 : blockDepth);
+                if (decoder.cursor != decoder.end || (isTop && decoder.nextBlock != blocksEnd)
+                    || decoder.indexCursor != decoder.indexEnd) {
+                        throw std::runtime_error("octree archive block doesn't fill its nodes");
+                }
+        }
+};
+
+#endif //__OCTREEARCHIVE_HPP
@@ -0,0 +1,694 @@
+#ifndef __OCTREECSG_HPP
+#define __OCTREECSG_HPP
+
+#include "types.hpp"
+#include "Func/Func.hpp"
+#include "VoxelOctree.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Union, subtraction and intersection of a VoxelOctree with another octree or
+// an analytic shape, worked out on the nodes instead of on voxels.
+//
+// Both operands are walked together from the root and a cell is only split
+// where neither side decides it alone. Where one side is empty or solid the
+// result is either solid, empty or the other side, and the other side's
+// subtree is copied over as the contiguous range getSubtreeSize() describes
+// without being visited. Two bricks are combined bitwise. Nodes and bricks that
+// come out empty or full of one attribute collapse, and nodes that come out
+// the same as in a are copied from a. So the work follows the boundary where
+// the operands overlap, not their volume.
+//
+// The eight children of the root are combined on their own threads into their
+// own pools of new nodes. Then the layout of the result is worked out, far
+// pointers included, and the octants are written out in parallel again.
+//
+// Solid voxels keep the attributes of the side they come from. Where both
+// sides are solid, a union takes them from a side that is solid over a whole
+// larger cell, so that cells can stay collapsed or be copied; between voxels
+// of the same size a wins. An intersection only uses b as a mask and always
+// keeps a's, so where a is solid it is split down to b's structure. New
+// nodes and bricks get a palette of their own.
+namespace Csg {
+
+enum Op : uint8 { UNION, SUBTRACT, INTERSECT };
+
+// Analytic shapes in the unit cube the octree covers. classify() is 1 if a
+// cell is entirely inside, -1 if it is entirely outside and 0 otherwise;
+// contains() decides single voxels by their center.
+struct Sphere {
+        glm::vec3 center;
+        float radius;
+        uint32 attribute = VoxelAttributes::DEFAULT;
+
+        int classify(glm::vec3 pos, float size) const {
+                auto nearest = glm::max(pos, glm::min(center, pos + size)) - center;
+                auto farthest = glm::max(glm::abs(pos - center), glm::abs(pos + size - center));
+                if (glm::dot(nearest, nearest) > radius * radius) { return -1; }
+                if (glm::dot(farthest, farthest) <= radius * radius) { return 1; }
+                return 0;
+        }
+        bool contains(glm::vec3 p) const {
+                return glm::dot(p - center, p - center) <= radius * radius;
+        }
+};
+
+struct Box {
+        glm::vec3 min;
+        glm::vec3 max;
+        uint32 attribute = VoxelAttributes::DEFAULT;
+
+        int classify(glm::vec3 pos, float size) const {
+                for (int i : range(0,3)) {
+                        if (pos[i] >= max[i] || pos[i] + size <= min[i]) { return -1; }
+                }
+                for (int i : range(0,3)) {
+                        if (pos[i] < min[i] || pos[i] + size > max[i]) { return 0; }
+                }
+                return 1;
+        }
+        bool contains(glm::vec3 p) const {
+                for (int i : range(0,3)) {
+                        if (p[i] < min[i] || p[i] > max[i]) { return false; }
+                }
+                return true;
+        }
+};
+
+enum CellKind : uint8 { CELL_EMPTY, CELL_SOLID, CELL_NODE, CELL_BRICK, CELL_PARTIAL };
+
+// One operand over one cell. A brick cell covers region, the bits of brick it
+// is made of: all 64 for a whole brick, 8 for a 2x2x2 part of one.
+struct Cell {
+        CellKind kind;
+        uint idx;         // NODE: the node. BRICK: the brick, for its attributes.
+        uint64 brick;
+        uint64 region;
+        uint32 attribute; // SOLID
+};
+
+Cell emptyCell() { return {CELL_EMPTY, 0, 0, 0, 0}; }
+Cell solidCell(uint32 attribute) { return {CELL_SOLID, 0, 0, 0, attribute}; }
+
+// Bits of a brick making up the size^3 block with its low corner at (x, y, z).
+uint64 brickRegion(uint x, uint y, uint z, uint size) {
+        uint64 region = 0;
+        for (uint dz : range(0u,size)) {
+                for (uint dy : range(0u,size)) {
+                        for (uint dx : range(0u,size)) {
+                                region |= uint64(1) << brickBit(x + dx, y + dy, z + dz);
+                        }
+                }
+        }
+        return region;
+}
+
+// A part that is full of one attribute becomes solid.
+template<typename AttributeF>
+void splitBrick(const Cell& cell, AttributeF getAttribute, Cell children[8]) {
+        uint low = __builtin_ctzll(cell.region);
+        uint childSize = cell.region == ~uint64(0) ? 2 : 1;
+        for (uint i : range(0u,8u)) {
+                uint64 region = brickRegion((low & 3) + (i & 1) * childSize, (low >> 2 & 3) + (i >> 1 & 1) * childSize,
+                                            (low >> 4) + (i >> 2 & 1) * childSize, childSize);
+                uint64 occupied = cell.brick & region;
+                bool isUniform = occupied == region;
+                uint32 attribute = isUniform ? getAttribute(__builtin_ctzll(region)) : 0;
+                for (uint64 bits = region; isUniform && bits != 0; bits &= bits - 1) {
+                        isUniform = getAttribute(__builtin_ctzll(bits)) == attribute;
+                }
+                if (occupied == 0) { children[i] = emptyCell(); }
+                else if (isUniform) { children[i] = solidCell(attribute); }
+                else { children[i] = {CELL_BRICK, cell.idx, cell.brick, region, 0}; }
+        }
+}
+
+struct OctreeOperand {
+        const VoxelOctree& oct;
+
+        Cell root() const { return {CELL_NODE, 0, 0, 0, 0}; }
+
+        // rank counts the solid children or brick bits before the voxel.
+        uint32 getAttribute(uint nodeIdx, uint rank) const {
+                if (oct.attributes.ptrs.empty()) { return VoxelAttributes::DEFAULT; }
+                return oct.attributes.lookup(nodeIdx, rank);
+        }
+        uint32 getBrickAttribute(const Cell& cell, uint bit) const {
+                return getAttribute(cell.idx, popCount64(cell.brick & ((uint64(1) << bit) - 1)));
+        }
+
+        void split(const Cell& cell, glm::vec3, float, uint, Cell children[8]) const {
+                if (cell.kind == CELL_BRICK) {
+                        splitBrick(cell, [&](uint bit) { return getBrickAttribute(cell, bit); }, children);
+                        return;
+                }
+                const VoxelNode& node = oct.nodes[cell.idx].node;
+                uint8 solidMask = node.validMask & node.leafMask;
+                for (uint i : range(0u,8u)) {
+                        uint8 bit = 1 << i;
+                        if (solidMask & bit) {
+                                children[i] = solidCell(getAttribute(cell.idx, popCount(solidMask & (bit - 1))));
+                        }
+                        else if (node.getNodeMask() & bit) {
+                                children[i] = {CELL_NODE, oct.getChildIdx(cell.idx, i), 0, 0, 0};
+                        }
+                        else if (node.getBrickMask() & bit) {
+                                uint brickIdx = oct.getChildIdx(cell.idx, i);
+                                children[i] = {CELL_BRICK, brickIdx, oct.getBrick(brickIdx), ~uint64(0), 0};
+                        }
+                        else {
+                                children[i] = emptyCell();
+                        }
+                }
+        }
+
+        const VoxelOctree* getOctree() const { return &oct; }
+};
+
+// Voxels are at depth, and cells the shape only partly covers are rasterized
+// into bricks two levels above that.
+template<typename ShapeT>
+struct ShapeOperand {
+        ShapeT shape;
+        uint depth;
+
+        Cell root() const { return classify(glm::vec3(0.0f), 1.0f, 0); }
+
+        Cell classify(glm::vec3 pos, float size, uint level) const {
+                int side = shape.classify(pos, size);
+                if (side < 0) { return emptyCell(); }
+                if (side > 0) { return solidCell(shape.attribute); }
+                if (level + 2 < depth) { return {CELL_PARTIAL, 0, 0, 0, 0}; }
+
+                float voxelSize = size * 0.25f;
+                uint64 brick = 0;
+                for (uint z : range(0u,4u)) {
+                        for (uint y : range(0u,4u)) {
+                                for (uint x : range(0u,4u)) {
+                                        if (shape.contains(pos + (glm::vec3(x, y, z) + 0.5f) * voxelSize)) {
+                                                brick |= uint64(1) << brickBit(x, y, z);
+                                        }
+                                }
+                        }
+                }
+                if (brick == 0) { return emptyCell(); }
+                if (brick == ~uint64(0)) { return solidCell(shape.attribute); }
+                return {CELL_BRICK, 0, brick, ~uint64(0), 0};
+        }
+
+        uint32 getBrickAttribute(const Cell&, uint) const { return shape.attribute; }
+
+        void split(const Cell& cell, glm::vec3 pos, float size, uint level, Cell children[8]) const {
+                if (cell.kind == CELL_BRICK) {
+                        splitBrick(cell, [&](uint) { return shape.attribute; }, children);
+                        return;
+                }
+                float half = size * 0.5f;
+                for (uint i : range(0u,8u)) {
+                        children[i] = classify(pos + childOffset(i) * half, half, level + 1);
+                }
+        }
+
+        const VoxelOctree* getOctree() const { return nullptr; }
+};
+
+struct Stats {
+        uint64 visitedCells = 0;
+        uint64 newNodes = 0;
+        uint64 newBricks = 0;
+        uint64 copiedSubtrees = 0;
+        uint64 copiedEntries = 0;
+};
+
+enum ResultKind : uint8 { RESULT_EMPTY, RESULT_SOLID, RESULT_NODE, RESULT_BRICK, RESULT_COPY };
+
+// A child in the result.
+struct Result {
+        ResultKind kind;
+        uint8 owner;      // NODE, BRICK: the pool it is in. COPY: 0 for a, 1 for b.
+        uint idx;         // NODE, BRICK: index in that pool. COPY: the node copied.
+        uint32 attribute; // SOLID
+};
+
+struct NewBrick {
+        uint64 brick;
+        uint attributeStart;
+        uint paletteStart;
+};
+
+struct NewNode {
+        Result children[8];
+        uint8 validMask = 0;
+        uint8 leafMask = 0;
+        uint8 farMask = 0;
+        uint subtreeSize = 0; // Entries of the descendants, as getSubtreeSize().
+        uint attributeStart = 0;
+        uint paletteStart = 0;
+};
+
+// New nodes and bricks of one octant, with palette indices and palettes for
+// their attributes.
+struct Pool {
+        std::vector<NewNode> nodes;
+        std::vector<NewBrick> bricks;
+        std::vector<uint8> indices;
+        std::vector<uint32> palettes;
+        uint64 visitedCells = 0;
+};
+
+template<typename OperandB>
+class Combiner {
+public:
+        static constexpr uint ROOT_POOL = 8;
+
+        Combiner(const VoxelOctree& a, const OperandB& b, Op op): a{a}, b(b), op(op) {}
+
+        VoxelOctree run(Stats* stats = nullptr, uint numThreads = 0) {
+                if (numThreads == 0) { numThreads = std::thread::hardware_concurrency(); }
+                numThreads = std::min(std::max(numThreads, 1u), 8u);
+
+                // The root always stays a node, even when everything collapses.
+                Cell aChildren[8], bChildren[8];
+                splitCell(a, a.root(), glm::vec3(0.0f), 1.0f, 0, aChildren);
+                splitCell(b, b.root(), glm::vec3(0.0f), 1.0f, 0, bChildren);
+                Result children[8];
+                runParallel(numThreads, 8, [&](uint i) {
+                        children[i] = combine(i, aChildren[i], bChildren[i], childOffset(i) * 0.5f, 0.5f, 1);
+                });
+                uint rootIdx = makeNode(ROOT_POOL, children);
+
+                VoxelOctree out;
+                const NewNode& root = pools[ROOT_POOL].nodes[rootIdx];
+                out.nodes.resize(1 + root.subtreeSize);
+                out.attributes.ptrs.resize(out.nodes.size(), {VoxelAttributes::NONE, 0});
+                mergeAttributes(out.attributes);
+
+                VoxelNode rootNode = {0, root.validMask, root.leafMask};
+                rootNode.setChildPtr(1, false);
+                out.nodes[0].node = rootNode;
+                out.attributes.ptrs[0] = {root.attributeStart + indexBases[ROOT_POOL], root.paletteStart + paletteBases[ROOT_POOL]};
+
+                std::vector<std::function<void()>> octants;
+                std::atomic<uint64> copiedSubtrees{0};
+                std::atomic<uint64> copiedEntries{0};
+                Writer writer{*this, out, copiedSubtrees, copiedEntries};
+                writer.writeChildren(root, 1, &octants);
+                runParallel(numThreads, octants.size(), [&](uint i) { octants[i](); });
+                out.compactAttributes();
+
+                if (stats) {
+                        *stats = Stats();
+                        for (auto& pool : pools) {
+                                stats->visitedCells += pool.visitedCells;
+                                stats->newNodes += pool.nodes.size();
+                                stats->newBricks += pool.bricks.size();
+                        }
+                        stats->copiedSubtrees = copiedSubtrees;
+                        stats->copiedEntries = copiedEntries;
+                }
+                return out;
+        }
+
+private:
+        OctreeOperand a;
+        OperandB b;
+        Op op;
+        Pool pools[ROOT_POOL + 1];
+        uint32 indexBases[ROOT_POOL + 1] = {0};
+        uint32 paletteBases[ROOT_POOL + 1] = {0};
+        uint32 sourceIndexBases[2] = {0};
+        uint32 sourcePaletteBases[2] = {0};
+
+        template<typename F>
+        static void runParallel(uint numThreads, uint numItems, F f) {
+                std::atomic<uint> nextItem{0};
+                auto worker = [&]() {
+                        for (uint item = nextItem++; item < numItems; item = nextItem++) { f(item); }
+                };
+                std::vector<std::thread> threads;
+                for (uint i = 1; i < std::min(numThreads, numItems); i++) { threads.emplace_back(worker); }
+                worker();
+                for (auto& thread : threads) { thread.join(); }
+        }
+
+        template<typename OperandT>
+        static void splitCell(const OperandT& operand, const Cell& cell, glm::vec3 pos, float size, uint level, Cell children[8]) {
+                if (cell.kind == CELL_EMPTY || cell.kind == CELL_SOLID) {
+                        std::fill(children, children + 8, cell);
+                        return;
+                }
+                operand.split(cell, pos, size, level, children);
+        }
+
+        const VoxelOctree* getSource(uint8 source) const {
+                return source == 0 ? a.getOctree() : b.getOctree();
+        }
+
+        // Whether the result is the other side wherever this side is uniform.
+        bool passesOther(const Cell& cell, bool isB) const {
+                switch (op) {
+                case UNION: return cell.kind == CELL_EMPTY;
+                case SUBTRACT: return isB && cell.kind == CELL_EMPTY;
+                case INTERSECT: return isB && cell.kind == CELL_SOLID;
+                }
+                return false;
+        }
+
+        static bool isWholeBrick(const Cell& cell) {
+                return cell.kind == CELL_BRICK && cell.region == ~uint64(0);
+        }
+        static bool isUniform(const Cell& cell) {
+                return cell.kind == CELL_EMPTY || cell.kind == CELL_SOLID;
+        }
+
+        Result combine(uint8 poolIdx, const Cell& ca, const Cell& cb, glm::vec3 pos, float size, uint level) {
+                pools[poolIdx].visitedCells++;
+                switch (op) {
+                case UNION:
+                        if (ca.kind == CELL_SOLID) { return {RESULT_SOLID, 0, 0, ca.attribute}; }
+                        if (cb.kind == CELL_SOLID) { return {RESULT_SOLID, 0, 0, cb.attribute}; }
+                        break;
+                case SUBTRACT:
+                        if (ca.kind == CELL_EMPTY || cb.kind == CELL_SOLID) { return {RESULT_EMPTY, 0, 0, 0}; }
+                        break;
+                case INTERSECT:
+                        if (ca.kind == CELL_EMPTY || cb.kind == CELL_EMPTY) { return {RESULT_EMPTY, 0, 0, 0}; }
+                        break;
+                }
+
+                // Take one side over as it is if it is uniform or a subtree.
+                for (uint8 source : {0, 1}) {
+                        const Cell& other = source == 0 ? ca : cb;
+                        if (!passesOther(source == 0 ? cb : ca, source == 0)) { continue; }
+                        if (other.kind == CELL_EMPTY) { return {RESULT_EMPTY, 0, 0, 0}; }
+                        if (other.kind == CELL_SOLID) { return {RESULT_SOLID, 0, 0, other.attribute}; }
+                        if (other.kind == CELL_NODE) { return {RESULT_COPY, source, other.idx, 0}; }
+                }
+
+                if ((isWholeBrick(ca) || isUniform(ca)) && (isWholeBrick(cb) || isUniform(cb))) {
+                        return combineBricks(poolIdx, ca, cb);
+                }
+
+                Cell aChildren[8], bChildren[8];
+                splitCell(a, ca, pos, size, level, aChildren);
+                splitCell(b, cb, pos, size, level, bChildren);
+
+                Pool& pool = pools[poolIdx];
+                uint nodesBefore = pool.nodes.size();
+                uint bricksBefore = pool.bricks.size();
+                uint indicesBefore = pool.indices.size();
+                uint palettesBefore = pool.palettes.size();
+
+                Result children[8];
+                float half = size * 0.5f;
+                for (uint i : range(0u,8u)) {
+                        children[i] = combine(poolIdx, aChildren[i], bChildren[i], pos + childOffset(i) * half, half, level + 1);
+                }
+
+                auto isKind = [&](ResultKind kind) {
+                        return std::all_of(children, children + 8, [&](const Result& child) { return child.kind == kind; });
+                };
+                bool isUniform = std::all_of(children, children + 8, [&](const Result& child) {
+                        return child.attribute == children[0].attribute;
+                });
+                if (isKind(RESULT_SOLID) && isUniform) { return {RESULT_SOLID, 0, 0, children[0].attribute}; }
+                if (isKind(RESULT_EMPTY)) { return {RESULT_EMPTY, 0, 0, 0}; }
+
+                if (ca.kind == CELL_NODE && isUnchanged(pool, aChildren, children)) {
+                        pool.nodes.resize(nodesBefore);
+                        pool.bricks.resize(bricksBefore);
+                        pool.indices.resize(indicesBefore);
+                        pool.palettes.resize(palettesBefore);
+                        return {RESULT_COPY, 0, ca.idx, 0};
+                }
+                return {RESULT_NODE, poolIdx, makeNode(poolIdx, children), 0};
+        }
+
+        // Whether children are the same as the children of a's node.
+        static bool isUnchanged(const Pool& pool, const Cell cells[8], const Result children[8]) {
+                for (uint i : range(0u,8u)) {
+                        const Cell& cell = cells[i];
+                        const Result& child = children[i];
+                        switch (cell.kind) {
+                        case CELL_EMPTY:
+                                if (child.kind != RESULT_EMPTY) { return false; }
+                                break;
+                        case CELL_SOLID:
+                                if (child.kind != RESULT_SOLID || child.attribute != cell.attribute) { return false; }
+                                break;
+                        case CELL_NODE:
+                                if (child.kind != RESULT_COPY || child.owner != 0 || child.idx != cell.idx) { return false; }
+                                break;
+                        default:
+                                // With the same bits every voxel is still a's.
+                                if (child.kind != RESULT_BRICK || pool.bricks[child.idx].brick != cell.brick) { return false; }
+                                break;
+                        }
+                }
+                return true;
+        }
+
+        // Both sides are whole bricks or uniform. In a union a voxel takes the
+        // attribute of a brick it is in before that of a solid cell, a's
+        // first; otherwise every voxel left is a's.
+        Result combineBricks(uint8 poolIdx, const Cell& ca, const Cell& cb) {
+                auto mask = [](const Cell& cell) {
+                        return cell.kind == CELL_SOLID ? ~uint64(0) : cell.kind == CELL_EMPTY ? 0 : cell.brick;
+                };
+                uint64 aMask = mask(ca);
+                uint64 bMask = mask(cb);
+                uint64 brick = op == UNION ? aMask | bMask : op == SUBTRACT ? aMask & ~bMask : aMask & bMask;
+                if (brick == 0) { return {RESULT_EMPTY, 0, 0, 0}; }
+
+                auto getAttribute = [&](uint bit) {
+                        bool inA = aMask >> bit & 1;
+                        bool inB = bMask >> bit & 1 && op == UNION;
+                        if (inA && (ca.kind == CELL_BRICK || !inB || cb.kind != CELL_BRICK)) {
+                                return ca.kind == CELL_BRICK ? a.getBrickAttribute(ca, bit) : ca.attribute;
+                        }
+                        return cb.kind == CELL_BRICK ? b.getBrickAttribute(cb, bit) : cb.attribute;
+                };
+                std::vector<uint32> values;
+                for (uint bit : range(0u,64u)) {
+                        if (brick >> bit & 1) { values.push_back(getAttribute(bit)); }
+                }
+                bool isUniform = std::all_of(values.begin(), values.end(), [&](uint32 value) { return value == values[0]; });
+                if (brick == ~uint64(0) && isUniform) { return {RESULT_SOLID, 0, 0, values[0]}; }
+
+                Pool& pool = pools[poolIdx];
+                pool.bricks.push_back({brick, uint(pool.indices.size()), addPalette(pool, values)});
+                return {RESULT_BRICK, poolIdx, uint(pool.bricks.size() - 1), 0};
+        }
+
+        // Appends the sorted distinct values as a palette and the index of
+        // every value in it, returning where the palette starts.
+        static uint addPalette(Pool& pool, const std::vector<uint32>& values) {
+                uint paletteStart = pool.palettes.size();
+                std::vector<uint32> palette = values;
+                std::sort(palette.begin(), palette.end());
+                palette.erase(std::unique(palette.begin(), palette.end()), palette.end());
+                pool.palettes.insert(pool.palettes.end(), palette.begin(), palette.end());
+                for (uint32 value : values) {
+                        pool.indices.push_back(std::lower_bound(palette.begin(), palette.end(), value) - palette.begin());
+                }
+                return paletteStart;
+        }
+
+        uint getSubtreeSize(const Result& child) const {
+                if (child.kind == RESULT_NODE) { return pools[child.owner].nodes[child.idx].subtreeSize; }
+                if (child.kind == RESULT_COPY) { return getSource(child.owner)->getSubtreeSize(child.idx); }
+                return 0;
+        }
+
+        uint makeNode(uint8 poolIdx, const Result children[8]) {
+                NewNode node;
+                std::vector<uint32> values;
+                uint childSizes[8] = {0};
+                for (uint i : range(0u,8u)) {
+                        uint8 bit = 1 << i;
+                        node.children[i] = children[i];
+                        switch (children[i].kind) {
+                        case RESULT_SOLID:
+                                node.validMask |= bit;
+                                node.leafMask |= bit;
+                                values.push_back(children[i].attribute);
+                                break;
+                        case RESULT_BRICK:
+                                node.leafMask |= bit;
+                                break;
+                        case RESULT_NODE:
+                        case RESULT_COPY:
+                                node.validMask |= bit;
+                                childSizes[i] = getSubtreeSize(children[i]);
+                                break;
+                        default:
+                                break;
+                        }
+                }
+                Pool& pool = pools[poolIdx];
+                node.attributeStart = pool.indices.size();
+                node.paletteStart = addPalette(pool, values);
+                node.subtreeSize = layoutChildren(node.validMask, node.leafMask, childSizes, node.farMask);
+                pool.nodes.push_back(node);
+                return pool.nodes.size() - 1;
+        }
+
+        // Picks the node children that need a far pointer, laid out the way
+        // VoxelOctree::addSubtree() does, and returns the number of entries
+        // the descendants take. Far pointer slots push the subtrees further
+        // away, so repeat until no more are needed.
+        static uint layoutChildren(uint8 validMask, uint8 leafMask, const uint childSizes[8], uint8& farMask) {
+                VoxelNode node = {0, validMask, leafMask};
+                uint blockSize = popCount(node.getValidNonLeaves()) + popCount(node.getBrickMask());
+                uint numFar = 0;
+                uint total = 0;
+                while (true) {
+                        farMask = 0;
+                        total = 0;
+                        uint count = 0;
+                        for (uint i : range(0u,8u)) {
+                                if (!(node.getNodeMask() & 1 << i)) { continue; }
+                                if (blockSize + numFar + total - node.getChildOffset(i) > 0x7fff) {
+                                        farMask |= 1 << i;
+                                        count++;
+                                }
+                                total += childSizes[i];
+                        }
+                        if (count == numFar) { break; }
+                        numFar = count;
+                }
+                return blockSize + numFar + total;
+        }
+
+        // Palette indices and palettes of a, then b, then every pool. The
+        // parts of a and b that aren't copied are dropped again by
+        // VoxelOctree::compactAttributes() once the result is written.
+        void mergeAttributes(VoxelAttributes& attributes) {
+                for (uint8 source : {0, 1}) {
+                        sourceIndexBases[source] = attributes.indices.size();
+                        sourcePaletteBases[source] = attributes.palettes.size();
+                        if (auto oct = getSource(source)) {
+                                attributes.indices.insert(attributes.indices.end(), oct->attributes.indices.begin(), oct->attributes.indices.end());
+                                attributes.palettes.insert(attributes.palettes.end(), oct->attributes.palettes.begin(), oct->attributes.palettes.end());
+                        }
+                }
+                for (uint i : range(0u,ROOT_POOL + 1)) {
+                        indexBases[i] = attributes.indices.size();
+                        paletteBases[i] = attributes.palettes.size();
+                        attributes.indices.insert(attributes.indices.end(), pools[i].indices.begin(), pools[i].indices.end());
+                        attributes.palettes.insert(attributes.palettes.end(), pools[i].palettes.begin(), pools[i].palettes.end());
+                }
+        }
+
+        struct Writer {
+                const Combiner& combiner;
+                VoxelOctree& out;
+                std::atomic<uint64>& copiedSubtrees;
+                std::atomic<uint64>& copiedEntries;
+
+                VoxelAttributes::Ptr copiedPtr(uint8 source, uint nodeIdx) const {
+                        auto& ptrs = combiner.getSource(source)->attributes.ptrs;
+                        if (ptrs.empty() || ptrs[nodeIdx].attributeIdx == VoxelAttributes::NONE) { return {VoxelAttributes::NONE, 0}; }
+                        return {ptrs[nodeIdx].attributeIdx + combiner.sourceIndexBases[source],
+                                ptrs[nodeIdx].paletteIdx + combiner.sourcePaletteBases[source]};
+                }
+
+                // The three passes of VoxelOctree::addSubtree(): the children
+                // from startPos on, the far pointer slots, then the subtree of
+                // every node child. With deferred set the subtrees are left
+                // to the caller.
+                void writeChildren(const NewNode& node, uint startPos, std::vector<std::function<void()>>* deferred = nullptr) {
+                        auto& nodes = out.nodes;
+                        auto& ptrs = out.attributes.ptrs;
+                        VoxelNode curNode = {0, node.validMask, node.leafMask};
+                        uint cursor = startPos;
+                        for (uint i : range(0u,8u)) {
+                                const Result& child = node.children[i];
+                                if (child.kind == RESULT_BRICK) {
+                                        const NewBrick& brick = combiner.pools[child.owner].bricks[child.idx];
+                                        nodes[cursor].farptr = brick.brick;
+                                        nodes[cursor + 1].farptr = brick.brick >> 32;
+                                        ptrs[cursor] = {brick.attributeStart + combiner.indexBases[child.owner],
+                                                        brick.paletteStart + combiner.paletteBases[child.owner]};
+                                        cursor += 2;
+                                }
+                                else if (child.kind == RESULT_NODE) {
+                                        const NewNode& newNode = combiner.pools[child.owner].nodes[child.idx];
+                                        nodes[cursor].node = VoxelNode{0, newNode.validMask, newNode.leafMask};
+                                        ptrs[cursor] = {newNode.attributeStart + combiner.indexBases[child.owner],
+                                                        newNode.paletteStart + combiner.paletteBases[child.owner]};
+                                        cursor++;
+                                }
+                                else if (child.kind == RESULT_COPY) {
+                                        const VoxelNode& source = combiner.getSource(child.owner)->nodes[child.idx].node;
+                                        nodes[cursor].node = VoxelNode{0, source.validMask, source.leafMask};
+                                        ptrs[cursor] = copiedPtr(child.owner, child.idx);
+                                        cursor++;
+                                }
+                        }
+
+                        uint farPtrs[8] = {0};
+                        for (uint i : range(0u,8u)) {
+                                if (node.farMask & 1 << i) { farPtrs[i] = cursor++; }
+                        }
+
+                        for (uint i : range(0u,8u)) {
+                                if (!(curNode.getNodeMask() & 1 << i)) { continue; }
+                                const Result& child = node.children[i];
+                                uint childIdx = startPos + curNode.getChildOffset(i);
+                                if (farPtrs[i] == 0) {
+                                        nodes[childIdx].node.setChildPtr(cursor - childIdx, false);
+                                }
+                                else {
+                                        nodes[childIdx].node.setChildPtr(farPtrs[i] - childIdx, true);
+                                        nodes[farPtrs[i]].farptr = cursor - farPtrs[i];
+                                }
+
+                                uint subtreeStart = cursor;
+                                cursor += combiner.getSubtreeSize(child);
+                                auto write = [this, &child, subtreeStart]() {
+                                        if (child.kind == RESULT_NODE) {
+                                                writeChildren(combiner.pools[child.owner].nodes[child.idx], subtreeStart);
+                                        }
+                                        else {
+                                                copySubtree(child.owner, child.idx, subtreeStart);
+                                        }
+                                };
+                                if (deferred) { deferred->push_back(write); }
+                                else { write(); }
+                        }
+                }
+
+                // Pointers inside the range are all relative, so it is copied
+                // as it is; only the attribute pointers are rebased.
+                void copySubtree(uint8 source, uint nodeIdx, uint startPos) {
+                        const VoxelOctree& oct = *combiner.getSource(source);
+                        uint begin = oct.getChildrenIdx(nodeIdx);
+                        uint size = oct.getSubtreeEnd(nodeIdx) - begin;
+                        std::copy(oct.nodes.begin() + begin, oct.nodes.begin() + begin + size, out.nodes.begin() + startPos);
+                        for (uint i : range(0u,size)) {
+                                out.attributes.ptrs[startPos + i] = copiedPtr(source, begin + i);
+                        }
+                        copiedSubtrees++;
+                        copiedEntries += size;
+                }
+        };
+};
+
+VoxelOctree apply(const VoxelOctree& a, const VoxelOctree& b, Op op, Stats* stats = nullptr, uint numThreads = 0) {
+        return Combiner<OctreeOperand>(a, OctreeOperand{b}, op).run(stats, numThreads);
+}
+
+// depth is the level a's voxels are at, as passed to VoxelOctree::create().
+template<typename ShapeT>
+VoxelOctree applyShape(const VoxelOctree& a, const ShapeT& shape, uint depth, Op op, Stats* stats = nullptr, uint numThreads = 0) {
+        return Combiner<ShapeOperand<ShapeT>>(a, ShapeOperand<ShapeT>{shape, depth}, op).run(stats, numThreads);
+}
+
+}
+
+#endif //__OCTREECSG_HPP
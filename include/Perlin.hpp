@@ -67,6 +67,11 @@ public:
                 }
 
         }
+        // Height of a column getHeight() has already been asked about.
+        uint getCachedHeight(uint x, uint y) const {
+                return cachedHeights[Morton::encode2(x, y)];
+        }
+        int getScale() const { return scale; }
 };
 
 }
@@ -0,0 +1,269 @@
+#ifndef __RAYCAST_HPP
+#define __RAYCAST_HPP
+
+#include "types.hpp"
+#include "VoxelOctree.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// CPU port of raycast() from VoxelShaderFrag.glsl. It follows the shader step
+// for step so traversal changes can be measured and debugged on the CPU. The
+// octree occupies the unit cube, and t is in units of d.
+namespace Raycast {
+
+uint floatBitsToUint(float x) {
+        uint result;
+        std::memcpy(&result, &x, sizeof(result));
+        return result;
+}
+
+float uintBitsToFloat(uint x) {
+        float result;
+        std::memcpy(&result, &x, sizeof(result));
+        return result;
+}
+
+int findMSB(uint x) {
+        return x == 0 ? -1 : 31 - __builtin_clz(x);
+}
+
+uint getChildIdx(const NodeOrFarPtr* nodes, uint parentIdx, uint childOctant) {
+        const VoxelNode& parent = nodes[parentIdx].node;
+        uint childrenIdx = parentIdx + parent.getChildPtr();
+        if (parent.isFar()) {
+                childrenIdx += nodes[childrenIdx].farptr;
+        }
+        return childrenIdx + parent.getChildOffset(childOctant);
+}
+
+struct Ray {
+        glm::vec3 coeffs;
+        glm::vec3 offsets;
+        uint octantMask;
+};
+
+Ray makeRay(glm::vec3 p, glm::vec3 d) {
+        Ray ray;
+        ray.octantMask = 0;
+        p += 1.0f;
+        if (d.x > 0.0f) { p.x = 3.0f - p.x; d.x *= -1.0f; ray.octantMask ^= 1 << 0; }
+        if (d.y > 0.0f) { p.y = 3.0f - p.y; d.y *= -1.0f; ray.octantMask ^= 1 << 1; }
+        if (d.z > 0.0f) { p.z = 3.0f - p.z; d.z *= -1.0f; ray.octantMask ^= 1 << 2; }
+        ray.coeffs = glm::vec3(1.0f/d.x, 1.0f/d.y, 1.0f/d.z);
+        ray.offsets = glm::vec3(-p.x * ray.coeffs.x, -p.y * ray.coeffs.y, -p.z * ray.coeffs.z);
+        return ray;
+}
+
+float tx(const Ray& ray, float x) { return x * ray.coeffs.x + ray.offsets.x; }
+float ty(const Ray& ray, float y) { return y * ray.coeffs.y + ray.offsets.y; }
+float tz(const Ray& ray, float z) { return z * ray.coeffs.z + ray.offsets.z; }
+
+float tenter(const Ray& ray, glm::vec3 pos) {
+        return std::max(std::max(tx(ray, pos.x), ty(ray, pos.y)), tz(ray, pos.z));
+}
+float texit(const Ray& ray, glm::vec3 pos) {
+        return std::min(std::min(tx(ray, pos.x), ty(ray, pos.y)), tz(ray, pos.z));
+}
+
+uint selectChild(const Ray& ray, glm::vec3 pos, float childScale, float t) {
+        uint childOctant = 0;
+        if (t < tx(ray, pos.x + childScale)) { childOctant ^= 1 << 0; }
+        if (t < ty(ray, pos.y + childScale)) { childOctant ^= 1 << 1; }
+        if (t < tz(ray, pos.z + childScale)) { childOctant ^= 1 << 2; }
+        return childOctant;
+}
+
+// Axis of the face a ray enters a cell through, given the cell's upper corner
+// in the ray's mirrored space; the one tenter() picks.
+uint entryAxis(const Ray& ray, glm::vec3 upper) {
+        float x = tx(ray, upper.x);
+        float y = ty(ray, upper.y);
+        float z = tz(ray, upper.z);
+        return x >= y && x >= z ? 0 : y >= z ? 1 : 2;
+}
+
+// Outward normal of that face, back in the ray's unmirrored space.
+glm::vec3 faceNormal(const Ray& ray, uint axis) {
+        auto normal = glm::vec3(0.0f);
+        normal[axis] = ray.octantMask & 1 << axis ? -1.0f : 1.0f;
+        return normal;
+}
+
+// Occupancy of the 4x4x4 slabs of a brick with x, y or z equal to 0; shift
+// left by brickBit() of the slab's coordinate for the others.
+constexpr uint64 BRICK_SLAB_X = 0x1111111111111111ull;
+constexpr uint64 BRICK_SLAB_Y = 0x000F000F000F000Full;
+constexpr uint64 BRICK_SLAB_Z = 0x000000000000FFFFull;
+
+// Walks the 4x4x4 cells of the brick at pos (in the ray's mirrored space)
+// from t on, and returns the t of the first occupied cell or -1 if the ray
+// leaves the brick. While the ray is inside a slab that is entirely empty it
+// jumps straight to the far side of that slab instead of visiting each cell.
+// hitRank is set to the number of set bits before the hit cell's and hitAxis
+// to the axis of the face it was entered through.
+float brickRaycast(const Ray& ray, uint64 brick, glm::vec3 pos, float scale, float t, uint& steps, uint& hitRank, uint& hitAxis) {
+        float cellScale = scale * 0.25f;
+        float brickExit = texit(ray, pos);
+        while (t < brickExit) {
+                steps++;
+                // Cells are counted from the mirrored upper corner, so the ray
+                // moves towards cell 0 on every axis like pos in raycast().
+                uint cellX = 0, cellY = 0, cellZ = 0;
+                for (uint b = 1; b < 4; b++) {
+                        if (t < tx(ray, pos.x + b * cellScale)) { cellX = b; }
+                        if (t < ty(ray, pos.y + b * cellScale)) { cellY = b; }
+                        if (t < tz(ray, pos.z + b * cellScale)) { cellZ = b; }
+                }
+                uint x = ray.octantMask & 1 << 0 ? 3 - cellX : cellX;
+                uint y = ray.octantMask & 1 << 1 ? 3 - cellY : cellY;
+                uint z = ray.octantMask & 1 << 2 ? 3 - cellZ : cellZ;
+                uint bit = brickBit(x, y, z);
+                if (brick >> bit & 1) {
+                        hitRank = popCount64(brick & ((uint64(1) << bit) - 1));
+                        hitAxis = entryAxis(ray, pos + (glm::vec3(cellX, cellY, cellZ) + 1.0f) * cellScale);
+                        return t;
+                }
+
+                float exitX = tx(ray, pos.x + cellX * cellScale);
+                float exitY = ty(ray, pos.y + cellY * cellScale);
+                float exitZ = tz(ray, pos.z + cellZ * cellScale);
+                float next = std::min(std::min(exitX, exitY), exitZ);
+                if (!(brick & BRICK_SLAB_X << brickBit(x, 0, 0))) { next = std::max(next, exitX); }
+                if (!(brick & BRICK_SLAB_Y << brickBit(0, y, 0))) { next = std::max(next, exitY); }
+                if (!(brick & BRICK_SLAB_Z << brickBit(0, 0, z))) { next = std::max(next, exitZ); }
+                t = next;
+        }
+        return -1.0f;
+}
+
+constexpr uint MAX_STACK_SIZE = 23;
+
+// t is -1 on a miss. steps counts iterations of the traversal loop and
+// fetches the node array entries read. The hit voxel's attributes are found
+// from nodeIdx, the node or brick it is in, and rank, see VoxelAttributes.
+// normal is that of the voxel face the ray hit.
+struct Hit {
+        float t;
+        uint steps;
+        uint fetches;
+        uint nodeIdx;
+        uint rank;
+        glm::vec3 normal;
+};
+
+// Traversal starts at tmin instead of the camera. The nodes on the way down
+// to the point at tmin are still visited, so any tmin in front of the first
+// hit gives the same result. Anything from tlimit on counts as a miss.
+Hit raycast(const NodeOrFarPtr* nodes, uint rootIdx, glm::vec3 p, glm::vec3 d,
+            float tmin = 0.0f, float tlimit = std::numeric_limits<float>::infinity()) {
+        Ray ray = makeRay(p, d);
+
+        uint parentStack[MAX_STACK_SIZE];
+        parentStack[0] = rootIdx;
+        uint depth = 0;
+        Hit hit = {-1.0f, 0, 0, 0, 0, glm::vec3(0.0f)};
+
+        float t = std::max(tmin, tenter(ray, glm::vec3(2.0f))); // Skip to the entrance of the octree.
+        float tmax = std::min(tlimit, texit(ray, glm::vec3(1.0f)));
+
+        float scale = 0.5f;
+        glm::vec3 pos = glm::vec3(1.0f, 1.0f, 1.0f);
+
+        uint childOctant = selectChild(ray, pos, scale, t);
+        pos += childOffset(childOctant) * scale;
+        while (depth < MAX_STACK_SIZE) {
+                hit.steps++;
+                if (tmax <= t) { return hit; }
+
+                const VoxelNode& parent = nodes[parentStack[depth]].node;
+                hit.fetches++;
+                uint octant = childOctant ^ ray.octantMask;
+                bool isValid = parent.validMask & 1 << octant;
+                bool isLeaf = parent.leafMask & 1 << octant;
+                if (isValid && isLeaf) {
+                        hit.t = t;
+                        hit.nodeIdx = parentStack[depth];
+                        hit.rank = popCount(parent.validMask & parent.leafMask & ((1 << octant) - 1));
+                        hit.normal = faceNormal(ray, entryAxis(ray, pos + scale));
+                        return hit;
+                }
+                else if (isLeaf) { // BRICK
+                        uint brickIdx = getChildIdx(nodes, parentStack[depth], octant);
+                        uint64 brick = nodes[brickIdx].farptr | uint64(nodes[brickIdx + 1].farptr) << 32;
+                        hit.fetches += parent.isFar() + 2;
+                        uint axis;
+                        float brickT = brickRaycast(ray, brick, pos, scale, t, hit.steps, hit.rank, axis);
+                        if (brickT >= tmax) { return hit; }
+                        if (brickT >= 0.0f) {
+                                hit.t = brickT;
+                                hit.nodeIdx = brickIdx;
+                                hit.normal = faceNormal(ray, axis);
+                                return hit;
+                        }
+                }
+                if (isValid) { // PUSH
+                        uint childIdx = getChildIdx(nodes, parentStack[depth], octant);
+                        hit.fetches += parent.isFar();
+                        depth++;
+                        parentStack[depth] = childIdx;
+                        scale *= 0.5f;
+                        childOctant = selectChild(ray, pos, scale, t);
+                        pos += childOffset(childOctant) * scale;
+                }
+                else { // ADVANCE or POP
+                        // Keep the exit times around so the comparisons below
+                        // see exactly the values t was chosen from.
+                        float exitX = tx(ray, pos.x);
+                        float exitY = ty(ray, pos.y);
+                        float exitZ = tz(ray, pos.z);
+                        t = std::min(std::min(exitX, exitY), exitZ);
+                        uint oldOctant = childOctant;
+                        uint differingBits = 0;
+                        if (t == exitX) {
+                                childOctant ^= 1 << 0;
+                                float next = pos.x - scale;
+                                differingBits |= floatBitsToUint(pos.x) ^ floatBitsToUint(next);
+                                pos.x = next;
+                        }
+                        if (t == exitY) {
+                                childOctant ^= 1 << 1;
+                                float next = pos.y - scale;
+                                differingBits |= floatBitsToUint(pos.y) ^ floatBitsToUint(next);
+                                pos.y = next;
+                        }
+                        if (t == exitZ) {
+                                childOctant ^= 1 << 2;
+                                float next = pos.z - scale;
+                                differingBits |= floatBitsToUint(pos.z) ^ floatBitsToUint(next);
+                                pos.z = next;
+                        }
+                        if (~oldOctant & childOctant) {
+                                int msb = findMSB(differingBits);
+                                if (msb < 0 || msb > 22) {
+                                        return hit;
+                                }
+                                depth = 23 - msb;
+                                scale = std::exp2(-float(depth));
+                                depth--;
+
+                                uint shx = floatBitsToUint(pos.x) >> msb;
+                                pos.x = uintBitsToFloat(shx << msb);
+                                uint shy = floatBitsToUint(pos.y) >> msb;
+                                pos.y = uintBitsToFloat(shy << msb);
+                                uint shz = floatBitsToUint(pos.z) >> msb;
+                                pos.z = uintBitsToFloat(shz << msb);
+
+                                childOctant = (shx & 1) | ((shy & 1) << 1) | ((shz & 1) << 2);
+                        }
+                }
+        }
+        hit.t = t;
+        return hit;
+}
+
+}
+
+#endif //__RAYCAST_HPP
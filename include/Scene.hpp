@@ -0,0 +1,229 @@
+#ifndef __SCENE_HPP
+#define __SCENE_HPP
+
+#include "types.hpp"
+#include "VoxelOctree.hpp"
+#include "Raycast.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// Two-level world: a BVH over transformed instances of octree assets.
+//
+// Each asset is added once and its nodes are appended to a shared pool; the
+// child pointers inside a VoxelOctree are all relative, so an asset only needs
+// to remember where its root ended up. Instances map world space into their
+// asset's unit cube, and rays walk the BVH first and then the instance's
+// nodes in local space. Local rays aren't renormalized, so t stays in world
+// units throughout.
+
+struct Aabb {
+        glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+        void extend(glm::vec3 p) {
+                min = glm::min(min, p);
+                max = glm::max(max, p);
+        }
+        void extend(const Aabb& other) {
+                extend(other.min);
+                extend(other.max);
+        }
+        glm::vec3 center() const { return (min + max) * 0.5f; }
+
+        // Entry distance along the ray past tmin, or infinity if it misses.
+        float intersect(glm::vec3 p, glm::vec3 invD, float tmin = 0.0f) const {
+                glm::vec3 t0 = (min - p) * invD;
+                glm::vec3 t1 = (max - p) * invD;
+                glm::vec3 tnear = glm::min(t0, t1);
+                glm::vec3 tfar = glm::max(t0, t1);
+                float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, tmin));
+                float exit = std::min(std::min(tfar.x, tfar.y), tfar.z);
+                return enter <= exit ? enter : std::numeric_limits<float>::infinity();
+        }
+};
+
+struct SceneInstance {
+        glm::mat4 worldToLocal;
+        uint rootIdx;
+};
+
+// Interior nodes have count == 0 and their children at leftOrFirst and
+// leftOrFirst + 1. Leaves cover instances [leftOrFirst, leftOrFirst + count).
+struct SceneBvhNode {
+        Aabb bounds;
+        uint leftOrFirst;
+        uint count;
+};
+
+struct Scene {
+        static constexpr uint MAX_LEAF_SIZE = 2;
+        static constexpr uint MAX_BVH_DEPTH = 32;
+
+        std::vector<NodeOrFarPtr> nodes;
+        VoxelAttributes attributes;
+        std::vector<uint> assetRoots;
+        std::vector<SceneInstance> instances;
+        std::vector<Aabb> instanceBounds;
+        std::vector<SceneBvhNode> bvh;
+
+        uint addAsset(const VoxelOctree& oct) {
+                assetRoots.push_back(nodes.size());
+                nodes.insert(nodes.end(), oct.nodes.begin(), oct.nodes.end());
+                attributes.append(oct.attributes, oct.nodes.size());
+                return assetRoots.size() - 1;
+        }
+
+        // localToWorld places the asset's unit cube in the world.
+        void addInstance(uint asset, const glm::mat4& localToWorld) {
+                instances.push_back({glm::inverse(localToWorld), assetRoots[asset]});
+                Aabb bounds;
+                for (uint corner = 0; corner < 8; corner++) {
+                        auto p = glm::vec4(corner >> 0 & 1, corner >> 1 & 1, corner >> 2 & 1, 1.0f);
+                        bounds.extend(glm::vec3(localToWorld * p));
+                }
+                instanceBounds.push_back(bounds);
+        }
+
+        // Must be called after the last addInstance() and before tracing.
+        void build() {
+                bvh.clear();
+                if (instances.empty()) { return; }
+                std::vector<uint> order(instances.size());
+                for (uint i = 0; i < order.size(); i++) { order[i] = i; }
+
+                bvh.emplace_back();
+                buildNode(0, order, 0, order.size(), 0);
+
+                std::vector<SceneInstance> sortedInstances;
+                std::vector<Aabb> sortedBounds;
+                for (uint i : order) {
+                        sortedInstances.push_back(instances[i]);
+                        sortedBounds.push_back(instanceBounds[i]);
+                }
+                instances.swap(sortedInstances);
+                instanceBounds.swap(sortedBounds);
+        }
+
+        // See Raycast::raycast(). The normal is in world space.
+        Raycast::Hit raycast(glm::vec3 p, glm::vec3 d, float tmin = 0.0f,
+                             float tlimit = std::numeric_limits<float>::infinity()) const {
+                Raycast::Hit result = {-1.0f, 0, 0, 0, 0, glm::vec3(0.0f)};
+                if (bvh.empty()) { return result; }
+
+                float bestT = tlimit;
+                glm::vec3 invD = 1.0f / d;
+                uint stack[MAX_BVH_DEPTH * 2];
+                uint stackSize = 0;
+                stack[stackSize++] = 0;
+                while (stackSize > 0) {
+                        const SceneBvhNode& node = bvh[stack[--stackSize]];
+                        result.steps++;
+                        if (node.bounds.intersect(p, invD, tmin) >= bestT) { continue; }
+
+                        if (node.count > 0) {
+                                for (uint i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                                        auto& instance = instances[i];
+                                        auto localP = glm::vec3(instance.worldToLocal * glm::vec4(p, 1.0f));
+                                        auto localD = glm::vec3(instance.worldToLocal * glm::vec4(d, 0.0f));
+                                        auto hit = Raycast::raycast(nodes.data(), instance.rootIdx, localP, localD, tmin, bestT);
+                                        result.steps += hit.steps;
+                                        result.fetches += hit.fetches;
+                                        if (hit.t >= 0.0f && hit.t < bestT) {
+                                                bestT = hit.t;
+                                                result.nodeIdx = hit.nodeIdx;
+                                                result.rank = hit.rank;
+                                                result.normal = glm::normalize(glm::transpose(glm::mat3(instance.worldToLocal)) * hit.normal);
+                                        }
+                                }
+                                continue;
+                        }
+
+                        // Visit the nearer child first.
+                        uint nearChild = node.leftOrFirst;
+                        uint farChild = node.leftOrFirst + 1;
+                        if (bvh[farChild].bounds.intersect(p, invD, tmin) < bvh[nearChild].bounds.intersect(p, invD, tmin)) {
+                                std::swap(nearChild, farChild);
+                        }
+                        stack[stackSize++] = farChild;
+                        stack[stackSize++] = nearChild;
+                }
+
+                if (bestT < tlimit) { result.t = bestT; }
+                return result;
+        }
+
+        // Packed color and material of the voxel a ray hit.
+        uint32 getAttribute(const Raycast::Hit& hit) const {
+                return attributes.lookup(hit.nodeIdx, hit.rank);
+        }
+
+        uint64 memoryBytes() const {
+                return nodes.size() * sizeof(NodeOrFarPtr)
+                        + attributes.bytes()
+                        + instances.size() * sizeof(SceneInstance)
+                        + bvh.size() * sizeof(SceneBvhNode);
+        }
+
+        // GPU layout, one RGBA32F texel per vec4. BVH nodes are two texels:
+        // (min, leftOrFirst) and (max, count). Instances are four: the first
+        // three rows of worldToLocal, then (rootIdx, 0, 0, 0). Integers are
+        // stored as float bits.
+        std::vector<glm::vec4> packBvh() const {
+                std::vector<glm::vec4> texels;
+                for (auto& node : bvh) {
+                        texels.push_back(glm::vec4(node.bounds.min, Raycast::uintBitsToFloat(node.leftOrFirst)));
+                        texels.push_back(glm::vec4(node.bounds.max, Raycast::uintBitsToFloat(node.count)));
+                }
+                return texels;
+        }
+
+        std::vector<glm::vec4> packInstances() const {
+                std::vector<glm::vec4> texels;
+                for (auto& instance : instances) {
+                        auto& m = instance.worldToLocal;
+                        for (int row = 0; row < 3; row++) {
+                                texels.push_back(glm::vec4(m[0][row], m[1][row], m[2][row], m[3][row]));
+                        }
+                        texels.push_back(glm::vec4(Raycast::uintBitsToFloat(instance.rootIdx), 0.0f, 0.0f, 0.0f));
+                }
+                return texels;
+        }
+
+private:
+        // Median split along the longest axis of the instance centers.
+        void buildNode(uint nodeIdx, std::vector<uint>& order, uint first, uint count, uint depth) {
+                Aabb bounds, centers;
+                for (uint i = first; i < first + count; i++) {
+                        bounds.extend(instanceBounds[order[i]]);
+                        centers.extend(instanceBounds[order[i]].center());
+                }
+                bvh[nodeIdx].bounds = bounds;
+
+                if (count <= MAX_LEAF_SIZE || depth + 1 >= MAX_BVH_DEPTH) {
+                        bvh[nodeIdx].leftOrFirst = first;
+                        bvh[nodeIdx].count = count;
+                        return;
+                }
+
+                glm::vec3 extent = centers.max - centers.min;
+                int axis = 0;
+                if (extent.y > extent[axis]) { axis = 1; }
+                if (extent.z > extent[axis]) { axis = 2; }
+
+                uint half = count / 2;
+                std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                        [&](uint a, uint b) { return instanceBounds[a].center()[axis] < instanceBounds[b].center()[axis]; });
+
+                uint left = bvh.size();
+                bvh[nodeIdx].leftOrFirst = left;
+                bvh[nodeIdx].count = 0;
+                bvh.emplace_back();
+                bvh.emplace_back();
+                buildNode(left, order, first, half, depth + 1);
+                buildNode(left + 1, order, first + half, count - half, depth + 1);
+        }
+};
+
+#endif //__SCENE_HPP
@@ -1,3 +1,6 @@
+#ifndef __TIMER_HPP
+#define __TIMER_HPP
+
 #include <chrono>
 #include <thread>
 #include <iostream>
@@ -9,6 +12,9 @@ private:
         const Clock::time_point start;
 public:
         Timer(): start(Clock::now()) {}
+        Clock::duration elapsed() const {
+                return Clock::now() - start;
+        }
         void roundTo(Clock::duration duration) {
                 auto end = Clock::now();
                 auto wait = start - end + duration;
@@ -17,3 +23,5 @@ public:
                 }
         }
 };
+
+#endif //__TIMER_HPP
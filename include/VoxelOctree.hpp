@@ -0,0 +1,600 @@
+#ifndef __VOXELOCTREE_HPP
+#define __VOXELOCTREE_HPP
+
+#include "types.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <iostream>
+
+#include <bitset>
+template <typename T> auto bits(T x) {
+        return std::bitset<sizeof(T)*8>(*(unsigned long long*)&x);
+}
+
+#include "Func/Func.hpp"
+#include "Morton.hpp"
+
+// Bit index of voxel (x, y, z) within a 4x4x4 brick.
+uint brickBit(uint x, uint y, uint z) {
+        return x + 4*y + 16*z;
+}
+
+// Position of a child octant within its parent, in units of the child's size.
+glm::vec3 childOffset(uint childOctant) {
+        return glm::vec3(childOctant >> 0 & 1, childOctant >> 1 & 1, childOctant >> 2 & 1);
+}
+
+uint popCount64(uint64 x) {
+        return __builtin_popcountll(x);
+}
+
+// Voxel attributes are a color packed as RGBA8 with a material id in place
+// of alpha, so the GPU can read palettes as a plain RGBA8 texture.
+enum Material : uint8 {
+        MATERIAL_STONE,
+        MATERIAL_DIRT,
+        MATERIAL_GRASS,
+        MATERIAL_ROCK,
+        MATERIAL_SNOW
+};
+
+uint32 packAttribute(float r, float g, float b, Material material) {
+        auto channel = [](float x) { return uint32(std::min(std::max(x, 0.0f), 1.0f) * 255.0f + 0.5f); };
+        return channel(r) | channel(g) << 8 | channel(b) << 16 | uint32(material) << 24;
+}
+
+// Solid children keep their attribute in attributes[]. Bricks keep one per
+// set bit, in bit order, starting at attributeStart in
+// PreVoxelOctree::brickAttributes.
+struct PreVoxelOctreeNode {
+        uint childIdxs[8] = {0};
+        uint8 validMask = 0;
+        uint8 leafMask = 0;
+        uint subtreeSize = 0;
+        bool isBrick = false;
+        uint64 brick = 0;
+        uint32 attributes[8] = {0};
+        uint attributeStart = 0;
+        uint paletteStart = 0;
+        uint paletteSize = 0;
+
+        void print() const {
+                std::cout << bits(validMask) << '\t' << bits(leafMask) << '\t' << subtreeSize << std::endl;
+                for (auto i : range(0,8)) {
+                        std::cout << i << ": " << childIdxs[i] << std::endl;
+                }
+        }
+};
+
+#include <vector>
+// With useBricks set, subtrees covering 4x4x4 voxels that are neither full
+// nor empty end in a brick: a single node holding a 64-bit occupancy mask
+// instead of two more levels of nodes.
+//
+// A solid child that stands for a whole collapsed subtree takes the
+// attributes of its top corner voxel, the last one in Morton order, since
+// that is the one most likely to be seen. Attributes are only looked up
+// (with vox.getAttribute()) for solid children and brick voxels that make it
+// into the tree, so the buried bulk of the terrain costs nothing.
+struct PreVoxelOctree {
+        static constexpr uint MAX_PALETTE_SIZE = 256;
+
+        std::vector<PreVoxelOctreeNode> nodePool;
+        bool useBricks = false;
+        uint numBricks = 0;
+        std::vector<uint32> brickAttributes;
+        std::vector<uint32> palettes;
+
+        // solidVoxel is set to the Morton index of the voxel whose attributes
+        // a solid result should take.
+        template<typename MVoxIterT>
+        bool addSubtree(uint size, MVoxIterT& vox, uint32& solidVoxel) {
+                if (size == 0) { bool v = *vox; solidVoxel = vox.idx; ++vox; return v; }
+                if (size == 2 && useBricks) { return addBrick(vox, solidVoxel); }
+
+                uint nodeIdx = nodePool.size();
+                uint bricksBefore = numBricks;
+                uint32 solidVoxels[8] = {0};
+                nodePool.emplace_back();
+
+                for(int i = 0; i < 8; i++) {
+                        uint curIdx = nodePool.size();
+                        nodePool[nodeIdx].childIdxs[i] = curIdx;
+
+                        bool isLeaf = addSubtree(size - 1, vox, solidVoxels[i]);
+                        if (nodePool.size() != curIdx && nodePool[curIdx].isBrick) {
+                                nodePool[nodeIdx].leafMask |= 1 << i;
+                        } else if (nodePool.size() != curIdx) {
+                                nodePool[nodeIdx].validMask |= 1 << i;
+                        } else if (isLeaf) {
+                                nodePool[nodeIdx].validMask |= 1 << i;
+                                nodePool[nodeIdx].leafMask |= 1 << i;
+                        }
+                }
+
+                // Bricks take two entries in the final node array.
+                nodePool[nodeIdx].subtreeSize = nodePool.size() - nodeIdx - 1 + numBricks - bricksBefore;
+                auto& node = nodePool[nodeIdx];
+                uint8 solidMask = node.validMask & node.leafMask;
+                bool collapses = solidMask == u'\xFF' || (node.validMask | node.leafMask) == u'\x00';
+                if (nodeIdx == 0 || !collapses) {
+                        for (int i : range(0,8)) {
+                                if (solidMask & 1 << i) { node.attributes[i] = vox.getAttribute(solidVoxels[i]); }
+                        }
+                }
+                if ((node.validMask & node.leafMask) == u'\xFF') {
+                        solidVoxel = solidVoxels[7];
+                        if (nodeIdx != 0) nodePool.pop_back();
+                        return true;
+                }
+                else if ((node.validMask | node.leafMask) == u'\x00') {
+                        if (nodeIdx != 0) nodePool.pop_back();
+                }
+                return false;
+        }
+
+        template<typename MVoxIterT>
+        bool addBrick(MVoxIterT& vox, uint32& solidVoxel) {
+                uint64 brick = 0;
+                uint32 voxels[64];
+                for (uint i = 0; i < 64; i++) {
+                        uint x, y, z;
+                        std::tie(x, y, z) = Morton::decode(i);
+                        if (*vox) {
+                                brick |= uint64(1) << brickBit(x, y, z);
+                                voxels[brickBit(x, y, z)] = vox.idx;
+                        }
+                        ++vox;
+                }
+                if (brick == ~uint64(0)) { solidVoxel = voxels[63]; return true; }
+                if (brick == 0) { return false; }
+
+                nodePool.emplace_back();
+                nodePool.back().isBrick = true;
+                nodePool.back().brick = brick;
+                nodePool.back().attributeStart = brickAttributes.size();
+                for (uint bit = 0; bit < 64; bit++) {
+                        if (brick >> bit & 1) { brickAttributes.push_back(vox.getAttribute(voxels[bit])); }
+                }
+                numBricks++;
+                return false;
+        }
+
+        // Gives every node and brick a palette of at most MAX_PALETTE_SIZE
+        // attributes, sharing one across as large a subtree as possible. A
+        // node whose subtree needs more gets a palette for its own solid
+        // children and its children are tried on their own; a brick always
+        // fits.
+        void assignPalettes(uint preIdx = 0) {
+                std::vector<uint32> values;
+                if (collectAttributes(preIdx, values, true)) {
+                        setPalette(preIdx, addPalette(values), values.size(), true);
+                        return;
+                }
+                values.clear();
+                collectAttributes(preIdx, values, false);
+                setPalette(preIdx, addPalette(values), values.size(), false);
+
+                auto& node = nodePool[preIdx];
+                for (int i : range(0,8)) {
+                        if ((node.validMask ^ node.leafMask) & 1 << i) { assignPalettes(node.childIdxs[i]); }
+                }
+        }
+
+        // Adds the attributes used by a node (and its subtree if recurse is
+        // set) to values, keeping it sorted and free of duplicates. Gives up
+        // and returns false once there are more than fit in a palette.
+        bool collectAttributes(uint preIdx, std::vector<uint32>& values, bool recurse) const {
+                auto insert = [&](uint32 value) {
+                        auto it = std::lower_bound(values.begin(), values.end(), value);
+                        if (it == values.end() || *it != value) { values.insert(it, value); }
+                        return values.size() <= MAX_PALETTE_SIZE;
+                };
+
+                auto& node = nodePool[preIdx];
+                if (node.isBrick) {
+                        for (uint k = 0; k < popCount64(node.brick); k++) {
+                                if (!insert(brickAttributes[node.attributeStart + k])) { return false; }
+                        }
+                        return true;
+                }
+                for (int i : range(0,8)) {
+                        uint8 bit = 1 << i;
+                        if ((node.validMask & node.leafMask & bit) && !insert(node.attributes[i])) { return false; }
+                        if (recurse && ((node.validMask ^ node.leafMask) & bit)
+                                    && !collectAttributes(node.childIdxs[i], values, true)) { return false; }
+                }
+                return true;
+        }
+
+        uint addPalette(const std::vector<uint32>& values) {
+                uint start = palettes.size();
+                palettes.insert(palettes.end(), values.begin(), values.end());
+                return start;
+        }
+
+        void setPalette(uint preIdx, uint start, uint size, bool recurse) {
+                auto& node = nodePool[preIdx];
+                node.paletteStart = start;
+                node.paletteSize = size;
+                if (!recurse || node.isBrick) { return; }
+                for (int i : range(0,8)) {
+                        if ((node.validMask ^ node.leafMask) & 1 << i) { setPalette(node.childIdxs[i], start, size, true); }
+                }
+        }
+
+        // Position of value in the palette of a node.
+        uint8 getPaletteIndex(const PreVoxelOctreeNode& node, uint32 value) const {
+                auto begin = palettes.begin() + node.paletteStart;
+                return std::lower_bound(begin, begin + node.paletteSize, value) - begin;
+        }
+
+        void print() const {
+                for (auto n : nodePool) { n.print(); }
+        }
+};
+
+#include "Perlin.hpp"
+struct SimpleMvoxIter {
+        uint64 idx = 0;
+        uint64 offset = 0;
+        mutable Perlin::CachedHeightmapGenerator gen;
+
+        SimpleMvoxIter(int scale = 8): gen(scale) {}
+
+        // Grass, rock and snow on the surface going up, dirt just below it
+        // and stone underneath. Noise varies the shade between neighbours.
+        // Only valid for solid voxels the iterator has already passed.
+        uint32 getAttribute(uint32 voxelIdx) const {
+                uint x, y, z;
+                std::tie(x, y, z) = Morton::decode(voxelIdx);
+                uint height = gen.getCachedHeight(x, y);
+                uint depth = height - 1 - z;
+                float altitude = height / exp2f(gen.getScale() + 1);
+                float shade = 0.8f + 0.2f * std::floor((Perlin::noise3d(x, y, z) * 0.5f + 0.5f) * 15.0f) / 15.0f;
+
+                if (depth == 0 && altitude < 0.45f) {
+                        float f = std::floor(altitude / 0.45f * 64.0f) / 64.0f;
+                        return packAttribute((0.2f + 0.4f * f) * shade, (0.6f - 0.1f * f) * shade, (0.1f + 0.2f * f) * shade, MATERIAL_GRASS);
+                }
+                if (depth == 0 && altitude < 0.65f) {
+                        float f = std::floor((altitude - 0.45f) / 0.2f * 16.0f) / 16.0f;
+                        return packAttribute((0.55f - 0.1f * f) * shade, (0.5f - 0.1f * f) * shade, 0.45f * shade, MATERIAL_ROCK);
+                }
+                if (depth == 0) {
+                        return packAttribute(0.95f * shade, 0.95f * shade, 1.0f * shade, MATERIAL_SNOW);
+                }
+                if (depth < 4) {
+                        return packAttribute(0.45f * shade, 0.32f * shade, 0.2f * shade, MATERIAL_DIRT);
+                }
+                return packAttribute(0.4f * shade, 0.4f * shade, 0.42f * shade, MATERIAL_STONE);
+        }
+
+        bool operator*() const {
+                uint x, y, z;
+                std::tie(x, y, z) = Morton::decode(idx);
+                uint height = gen.getHeight(x, y, z);
+                if (z == 0) { return true; }
+                else if (z < height) { return true; }
+                else { return false; }
+        }
+        void operator++() {
+                ++idx;
+        }
+};
+
+uint8 popCount(uint8 x) {
+        x -= (x >> 1) & '\x55';
+        x = (x & '\x33') + ((x >> 2) & '\x33');
+        return (x + (x >> 4)) & 0x0f;
+}
+
+struct VoxelNode {
+        uint16 _childPtr;
+        uint8 validMask;
+        uint8 leafMask;
+
+        void setChildPtr(uint16 offset, bool far) {
+                _childPtr = offset << 1;
+                if (far) _childPtr |= 1;
+        }
+        uint16 getChildPtr() const {
+                return _childPtr >> 1;
+        }
+        bool isFar() const {
+                return _childPtr & 1;
+        }
+        // A child is a solid leaf if both its valid and leaf bits are set,
+        // a node if only valid is set and a brick if only leaf is set. Nodes
+        // and bricks are stored together in octant order, bricks taking two
+        // entries for the low and high half of their mask.
+        uint8 getValidNonLeaves() const {
+                return validMask ^ leafMask;
+        }
+        uint8 getNodeMask() const {
+                return validMask & ~leafMask;
+        }
+        uint8 getBrickMask() const {
+                return leafMask & ~validMask;
+        }
+        uint getChildOffset(uint childOctant) const {
+                uint8 bitmask = uint8(~0) >> (8 - childOctant);
+                return popCount(getValidNonLeaves() & bitmask) + popCount(getBrickMask() & bitmask);
+        }
+
+        void print() const {
+                std::cout << bits(validMask) << '\t';
+                std::cout << bits(leafMask) << '\t';
+                std::cout << getChildPtr() << std::endl;
+        }
+};
+
+union NodeOrFarPtr {
+        VoxelNode node;
+        uint32 farptr;
+};
+
+// Per-voxel attributes, kept out of the nodes so traversal doesn't touch them.
+// ptrs runs parallel to VoxelOctree::nodes. The entry of a node points at the
+// palette indices of its solid children, in octant order; the first entry of
+// a brick points at those of its set bits, in bit order. So the attribute of
+// a hit is found from the node or brick it was in and its rank among the
+// solid children or bits before it. Indices are 8 bits wide and pick from a
+// palette shared by a whole subtree.
+struct VoxelAttributes {
+        static constexpr uint32 NONE = ~uint32(0);
+        static constexpr uint32 DEFAULT = 0x00FFFFFF; // White stone.
+
+        struct Ptr {
+                uint32 attributeIdx;
+                uint32 paletteIdx;
+        };
+
+        std::vector<Ptr> ptrs;
+        std::vector<uint8> indices;
+        std::vector<uint32> palettes;
+
+        uint32 lookup(uint nodeIdx, uint rank) const {
+                const Ptr& ptr = ptrs[nodeIdx];
+                if (ptr.attributeIdx == NONE) { return DEFAULT; }
+                return palettes[ptr.paletteIdx + indices[ptr.attributeIdx + rank]];
+        }
+
+        // Appends the attributes of numNodes more nodes, all NONE if other
+        // is empty (an octree built without them).
+        void append(const VoxelAttributes& other, uint numNodes) {
+                uint32 indexBase = indices.size();
+                uint32 paletteBase = palettes.size();
+                if (other.ptrs.empty()) {
+                        ptrs.resize(ptrs.size() + numNodes, {NONE, 0});
+                        return;
+                }
+                for (Ptr ptr : other.ptrs) {
+                        if (ptr.attributeIdx != NONE) {
+                                ptr.attributeIdx += indexBase;
+                                ptr.paletteIdx += paletteBase;
+                        }
+                        ptrs.push_back(ptr);
+                }
+                indices.insert(indices.end(), other.indices.begin(), other.indices.end());
+                palettes.insert(palettes.end(), other.palettes.begin(), other.palettes.end());
+        }
+
+        uint64 bytes() const {
+                return ptrs.size() * sizeof(Ptr) + indices.size() * sizeof(uint8) + palettes.size() * sizeof(uint32);
+        }
+
+        // Drops the indices and palette entries no lookup can reach, keeping
+        // the rest in order. counts is the number of attributes of every
+        // entry, see VoxelOctree::getAttributeCounts(); entries without any
+        // end up NONE.
+        void compact(const std::vector<uint8>& counts) {
+                // +1 where a range of palette entries in use starts, -1 one
+                // past its end.
+                std::vector<int> paletteUse(palettes.size() + 1, 0);
+                for (uint i : range(0u,uint(ptrs.size()))) {
+                        const Ptr& ptr = ptrs[i];
+                        if (ptr.attributeIdx == NONE || counts[i] == 0) { continue; }
+                        auto begin = indices.begin() + ptr.attributeIdx;
+                        uint8 maxIndex = *std::max_element(begin, begin + counts[i]);
+                        paletteUse[ptr.paletteIdx]++;
+                        paletteUse[ptr.paletteIdx + maxIndex + 1]--;
+                }
+
+                std::vector<uint32> paletteMap(palettes.size());
+                std::vector<uint32> newPalettes;
+                int inUse = 0;
+                for (uint i : range(0u,uint(palettes.size()))) {
+                        inUse += paletteUse[i];
+                        paletteMap[i] = newPalettes.size();
+                        if (inUse > 0) { newPalettes.push_back(palettes[i]); }
+                }
+
+                std::vector<uint8> newIndices;
+                for (uint i : range(0u,uint(ptrs.size()))) {
+                        Ptr& ptr = ptrs[i];
+                        if (ptr.attributeIdx == NONE || counts[i] == 0) { ptr = {NONE, 0}; continue; }
+                        auto begin = indices.begin() + ptr.attributeIdx;
+                        ptr = {uint32(newIndices.size()), paletteMap[ptr.paletteIdx]};
+                        newIndices.insert(newIndices.end(), begin, begin + counts[i]);
+                }
+                indices = std::move(newIndices);
+                palettes = std::move(newPalettes);
+        }
+};
+
+struct VoxelOctree {
+        std::vector<NodeOrFarPtr> nodes;
+        VoxelAttributes attributes;
+
+        // Bricks sit two levels above the voxels, below the root, so trees
+        // shallower than 3 levels are built without them.
+        static VoxelOctree create(uint depth = 10, bool useBricks = false) {
+                VoxelOctree self;
+                PreVoxelOctree preOct;
+                preOct.useBricks = useBricks && depth >= 3;
+                SimpleMvoxIter iter{int(depth) - 2};
+
+                uint32 solidVoxel;
+                preOct.addSubtree(depth, iter, solidVoxel);
+                preOct.assignPalettes();
+                self.attributes.palettes = preOct.palettes;
+
+                VoxelNode root;
+                root.validMask = preOct.nodePool[0].validMask;
+                root.leafMask = preOct.nodePool[0].leafMask;
+                root.setChildPtr(1, false);
+                self.nodes.push_back(NodeOrFarPtr{root});
+                self.addSubtree(preOct, 0, 0);
+                self.attributes.ptrs.resize(self.nodes.size(), {VoxelAttributes::NONE, 0});
+
+                return self;
+        }
+
+        void addSubtree(PreVoxelOctree& preOct, uint curPreIdx, uint curNodeIdx) {
+                uint startPos = nodes.size();
+
+                PreVoxelOctreeNode& curPreNode = preOct.nodePool[curPreIdx];
+                auto validNonLeaves = curPreNode.validMask ^ curPreNode.leafMask;
+                auto nodeChildren = curPreNode.validMask & ~curPreNode.leafMask;
+                auto isValidNonLeaf = [&](auto i) -> bool { return validNonLeaves & 1 << i; };
+                auto isNodeChild = [&](auto i) -> bool { return nodeChildren & 1 << i; };
+                for (int i : filter(isValidNonLeaf, range(0,8))) {
+                        auto& curPreChild = preOct.nodePool[curPreNode.childIdxs[i]];
+                        if (curPreChild.isBrick) {
+                                NodeOrFarPtr lo, hi;
+                                lo.farptr = curPreChild.brick;
+                                hi.farptr = curPreChild.brick >> 32;
+                                addAttributes(preOct, curPreChild, nodes.size());
+                                nodes.push_back(lo);
+                                nodes.push_back(hi);
+                                continue;
+                        }
+                        VoxelNode node;
+                        node.validMask = curPreChild.validMask;
+                        node.leafMask = curPreChild.leafMask;
+                        nodes.push_back(NodeOrFarPtr{node});
+                }
+
+                addAttributes(preOct, curPreNode, curNodeIdx);
+
+                VoxelNode curNode = {0, curPreNode.validMask, curPreNode.leafMask};
+                uint sum = 0;
+                uint farPtrs[8] = {0};
+                for (int i : filter(isNodeChild, range(0, 8))) {
+                        auto childIdx = startPos + curNode.getChildOffset(i);
+                        auto offset = sum + nodes.size() - childIdx;
+                        if (offset > 0x7fff) {
+                                farPtrs[i] = nodes.size();
+                                nodes.push_back(NodeOrFarPtr{{0}});
+                                continue;
+                        }
+                        sum += preOct.nodePool[curPreNode.childIdxs[i]].subtreeSize;
+                }
+
+                for (int i : filter(isNodeChild, range(0,8))) {
+                        auto childIdx = startPos + curNode.getChildOffset(i);
+
+                        if (farPtrs[i] == 0) {
+                                nodes[childIdx].node.setChildPtr(nodes.size() - childIdx, false);
+                        }
+                        else {
+                                nodes[childIdx].node.setChildPtr(farPtrs[i] - childIdx, true);
+                                nodes[farPtrs[i]].farptr = nodes.size() - farPtrs[i];
+                        }
+                        addSubtree(preOct, curPreNode.childIdxs[i], childIdx);
+                }
+        }
+
+        void addAttributes(const PreVoxelOctree& preOct, const PreVoxelOctreeNode& preNode, uint nodeIdx) {
+                if (attributes.ptrs.size() <= nodeIdx) {
+                        attributes.ptrs.resize(nodeIdx + 1, {VoxelAttributes::NONE, 0});
+                }
+                attributes.ptrs[nodeIdx] = {uint32(attributes.indices.size()), preNode.paletteStart};
+                if (preNode.isBrick) {
+                        for (uint k = 0; k < popCount64(preNode.brick); k++) {
+                                uint32 value = preOct.brickAttributes[preNode.attributeStart + k];
+                                attributes.indices.push_back(preOct.getPaletteIndex(preNode, value));
+                        }
+                        return;
+                }
+                for (int i : range(0,8)) {
+                        if (preNode.validMask & preNode.leafMask & 1 << i) {
+                                attributes.indices.push_back(preOct.getPaletteIndex(preNode, preNode.attributes[i]));
+                        }
+                }
+        }
+
+        // Resolves the (possibly far) child pointer of a node to the index of
+        // its first child, the same way getChildrenIdx() in the shader does.
+        uint getChildrenIdx(uint nodeIdx) const {
+                const VoxelNode& node = nodes[nodeIdx].node;
+                uint childrenIdx = nodeIdx + node.getChildPtr();
+                if (node.isFar()) {
+                        childrenIdx += nodes[childrenIdx].farptr;
+                }
+                return childrenIdx;
+        }
+
+        uint getChildIdx(uint nodeIdx, uint childOctant) const {
+                return getChildrenIdx(nodeIdx) + nodes[nodeIdx].node.getChildOffset(childOctant);
+        }
+
+        uint64 getBrick(uint brickIdx) const {
+                return nodes[brickIdx].farptr | uint64(nodes[brickIdx + 1].farptr) << 32;
+        }
+
+        // Number of entries (nodes, bricks and far pointers) written for the
+        // descendants of a node. addSubtree() emits them as one contiguous
+        // range starting at getChildrenIdx(), and every pointer inside that
+        // range is relative, so the range can be moved around as a unit.
+        uint getSubtreeSize(uint nodeIdx) const {
+                return getSubtreeEnd(nodeIdx) - getChildrenIdx(nodeIdx);
+        }
+
+        // One past the last entry of that range. The descendants of the last
+        // node child are written last, so only that chain is followed.
+        uint getSubtreeEnd(uint nodeIdx) const {
+                const VoxelNode& node = nodes[nodeIdx].node;
+                uint8 nodeChildren = node.getNodeMask();
+                if (nodeChildren == 0) {
+                        return getChildrenIdx(nodeIdx) + popCount(node.getValidNonLeaves()) + popCount(node.getBrickMask());
+                }
+                return getSubtreeEnd(getChildIdx(nodeIdx, 31 - __builtin_clz(nodeChildren)));
+        }
+
+        // Number of attributes of every entry: one per solid child of a node
+        // and one per set bit of a brick, none for far pointers and the high
+        // halves of bricks.
+        std::vector<uint8> getAttributeCounts() const {
+                std::vector<uint8> counts(nodes.size(), 0);
+                countAttributes(0, counts);
+                return counts;
+        }
+
+        void countAttributes(uint nodeIdx, std::vector<uint8>& counts) const {
+                const VoxelNode& node = nodes[nodeIdx].node;
+                counts[nodeIdx] = popCount(node.validMask & node.leafMask);
+                for (int i : range(0,8)) {
+                        if (node.getBrickMask() & 1 << i) {
+                                uint brickIdx = getChildIdx(nodeIdx, i);
+                                counts[brickIdx] = popCount64(getBrick(brickIdx));
+                        }
+                        else if (node.getNodeMask() & 1 << i) {
+                                countAttributes(getChildIdx(nodeIdx, i), counts);
+                        }
+                }
+        }
+
+        void compactAttributes() {
+                if (!attributes.ptrs.empty()) { attributes.compact(getAttributeCounts()); }
+        }
+
+        void print() const {
+                for (auto n : nodes) {
+                        n.node.print();
+                }
+        }
+};
+
+#endif //__VOXELOCTREE_HPP
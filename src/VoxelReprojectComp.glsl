@@ -0,0 +1,39 @@
+#version 450
+
+// Scatters last frame's primary hit distances into the pixels they land in
+// this frame, keeping the nearest. The distances are positive, so their bits
+// order like uints and imageAtomicMin works on them directly. startDistances
+// is cleared to the bits of +infinity before every pass. Frames only use the
+// lower left corner of the images when rendering at a reduced resolution, and
+// the two frames may differ in size. See reprojectHits() in CpuRenderer.hpp.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(r32f, binding = 0) uniform readonly image2D hitDistances;
+layout(r32ui, binding = 1) uniform uimage2D startDistances;
+
+uniform mat4 prevCamera;
+uniform mat4 cameraInverse;
+uniform ivec2 prevRenderSize;
+uniform ivec2 renderSize;
+
+void main() {
+        ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+        if (any(greaterThanEqual(pixel, prevRenderSize))) { return; }
+
+        float t = imageLoad(hitDistances, pixel).r;
+        if (t < 0.0f) { return; }
+
+        // The same ray main() in VoxelShaderFrag.glsl cast last frame.
+        vec2 screenPos = (vec2(pixel) + 0.5f) / vec2(prevRenderSize) * 2.0f - 1.0f;
+        vec3 p = vec3(prevCamera * vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        vec3 d = normalize(vec3(prevCamera * vec4(screenPos.x, 1.0f, screenPos.y*3/4, 1.0f)) - p);
+
+        vec3 local = vec3(cameraInverse * vec4(p + d*t, 1.0f));
+        if (local.y <= 0.0f) { return; }
+        vec2 newScreenPos = vec2(local.x / local.y, local.z / local.y * 4/3);
+        ivec2 newPixel = ivec2(floor((newScreenPos + 1.0f) * 0.5f * vec2(renderSize)));
+        if (any(lessThan(newPixel, ivec2(0))) || any(greaterThanEqual(newPixel, renderSize))) { return; }
+
+        imageAtomicMin(startDistances, newPixel, floatBitsToUint(length(local)));
+}
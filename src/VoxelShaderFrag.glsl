@@ -28,11 +28,15 @@ uint getValidMask(uint parentNode) {
         return bitfieldExtract(parentNode, 16, 8);
 }
 
+// Valid and leaf is a solid child, valid only a node and leaf only a 4x4x4
+// brick. Nodes and bricks are stored in octant order; bricks take two entries.
 uint getChildIdx(uint parentIdx, uint childOctant) {
         uint childrenIdx = getChildrenIdx(parentIdx);
         uint parentNode = getNode(parentIdx);
         uint hasNodeMask = getLeafMask(parentNode) ^ getValidMask(parentNode);
-        return childrenIdx + bitCount(hasNodeMask & (0xFF >> 8-childOctant));
+        uint brickMask = getLeafMask(parentNode) & ~getValidMask(parentNode);
+        uint prevMask = 0xFF >> 8-childOctant;
+        return childrenIdx + bitCount(hasNodeMask & prevMask) + bitCount(brickMask & prevMask);
 }
 
 bool checkMask(uint mask, uint octant) {
@@ -118,20 +122,81 @@ vec3 convertPos(Ray ray, vec3 pos, float scale) {
         return pos;
 }
 
+uint brickBit(uint x, uint y, uint z) {
+        return x + 4*y + 16*z;
+}
+
+bool checkBrick(uvec2 brick, uint bit) {
+        return bool(bit < 32 ? brick.x >> bit & 1 : brick.y >> (bit - 32) & 1);
+}
+
+bool checkSlabEmpty(uvec2 brick, uvec2 slab) {
+        return ((brick.x & slab.x) | (brick.y & slab.y)) == 0;
+}
+
+// Number of set bits in the brick before bit.
+uint brickRank(uvec2 brick, uint bit) {
+        return bit < 32 ? bitCount(brick.x & ((1u << bit) - 1u)) : bitCount(brick.x) + bitCount(brick.y & ((1u << (bit - 32)) - 1u));
+}
+
+// Walks the 4x4x4 cells of the brick at pos (in the ray's mirrored space)
+// from t on, and returns the t of the first occupied cell or -1 if the ray
+// leaves the brick. While the ray is inside a slab that is entirely empty it
+// jumps straight to the far side of that slab. See brickRaycast() in
+// Raycast.hpp.
+float brickRaycast(Ray ray, uint brickIdx, vec3 pos, float scale, float t, out uint hitRank) {
+        uvec2 brick = uvec2(getNode(brickIdx), getNode(brickIdx + 1));
+        float cellScale = scale * 0.25f;
+        float brickExit = texit(ray, pos);
+        while (t < brickExit) {
+                uvec3 cell = uvec3(0);
+                for (uint b = 1; b < 4; b++) {
+                        if (t < tx(ray, pos.x + b * cellScale)) { cell.x = b; }
+                        if (t < ty(ray, pos.y + b * cellScale)) { cell.y = b; }
+                        if (t < tz(ray, pos.z + b * cellScale)) { cell.z = b; }
+                }
+                uvec3 voxel = cell;
+                if (bool(ray.octantMask & 1 << 0)) { voxel.x = 3 - cell.x; }
+                if (bool(ray.octantMask & 1 << 1)) { voxel.y = 3 - cell.y; }
+                if (bool(ray.octantMask & 1 << 2)) { voxel.z = 3 - cell.z; }
+                uint bit = brickBit(voxel.x, voxel.y, voxel.z);
+                if (checkBrick(brick, bit)) {
+                        hitRank = brickRank(brick, bit);
+                        return t;
+                }
+
+                float exitX = tx(ray, pos.x + cell.x * cellScale);
+                float exitY = ty(ray, pos.y + cell.y * cellScale);
+                float exitZ = tz(ray, pos.z + cell.z * cellScale);
+                float next = min(min(exitX, exitY), exitZ);
+                uvec2 slabX = uvec2(0x11111111u << voxel.x);
+                uvec2 slabY = uvec2(0x000F000Fu << 4*voxel.y);
+                uvec2 slabZ = voxel.z < 2 ? uvec2(0xFFFFu << 16*voxel.z, 0) : uvec2(0, 0xFFFFu << 16*(voxel.z - 2));
+                if (checkSlabEmpty(brick, slabX)) { next = max(next, exitX); }
+                if (checkSlabEmpty(brick, slabY)) { next = max(next, exitY); }
+                if (checkSlabEmpty(brick, slabZ)) { next = max(next, exitZ); }
+                t = next;
+        }
+        return -1.0f;
+}
+
 const uint MAX_STACK_SIZE = 23;
 
 uniform float aspectRatio = 3/4;
 uniform float screenWidth = 1024;
 
-float raycast(vec3 p, vec3 d) {
+// Starts at tmin instead of the camera and counts anything from tlimit on as
+// a miss. The hit voxel's attributes are found from hitNode and hitRank, see
+// raycast() in Raycast.hpp.
+float raycast(uint rootIdx, vec3 p, vec3 d, float tmin, float tlimit, out uint hitNode, out uint hitRank) {
         Ray ray = makeRay(p, d);
 
         uint parentStack[MAX_STACK_SIZE];
-        parentStack[0] = 0;
+        parentStack[0] = rootIdx;
         uint depth = 0;
 
-        float t = max(0.0f, tenter(ray, vec3(2.0f))); // Skip to the entrance of the octree.
-        float tmax = texit(ray, vec3(1.0f));
+        float t = max(tmin, tenter(ray, vec3(2.0f))); // Skip to the entrance of the octree.
+        float tmax = min(tlimit, texit(ray, vec3(1.0f)));
 
         float scale = 0.5f;
         vec3 pos = vec3(1.0f, 1.0f, 1.0f);
@@ -141,10 +206,25 @@ float raycast(vec3 p, vec3 d) {
         while (depth < MAX_STACK_SIZE) {
                 if (tmax <= t) { return -1.0f; }
 
-                if(checkIsLeaf(getNode(parentStack[depth]), childOctant ^ ray.octantMask)) {
+                bool isLeaf = checkIsLeaf(getNode(parentStack[depth]), childOctant ^ ray.octantMask);
+                bool isValid = checkIsValid(getNode(parentStack[depth]), childOctant ^ ray.octantMask);
+                if (isLeaf && isValid) {
+                        uint parentNode = getNode(parentStack[depth]);
+                        uint solidMask = getValidMask(parentNode) & getLeafMask(parentNode);
+                        hitNode = parentStack[depth];
+                        hitRank = bitCount(solidMask & ((1u << (childOctant ^ ray.octantMask)) - 1u));
                         return t;
                 }
-                else if(checkIsValid(getNode(parentStack[depth]), childOctant ^ ray.octantMask)) { // PUSH
+                else if (isLeaf) { // BRICK
+                        uint brickIdx = getChildIdx(parentStack[depth], childOctant ^ ray.octantMask);
+                        float brickT = brickRaycast(ray, brickIdx, pos, scale, t, hitRank);
+                        if (brickT >= tmax) { return -1.0f; }
+                        if (brickT >= 0.0f) {
+                                hitNode = brickIdx;
+                                return brickT;
+                        }
+                }
+                if (isValid) { // PUSH
                         uint childIdx = getChildIdx(parentStack[depth], childOctant ^ ray.octantMask);
                         depth++;
                         parentStack[depth] = childIdx;
@@ -199,23 +279,140 @@ float raycast(vec3 p, vec3 d) {
         return t;
 }
 
-vec4 colorFromRay(vec3 p, vec3 d) {
+// Top level of the scene: a BVH over octree instances. BVH nodes are two
+// texels, (min, leftOrFirst) and (max, count); instances are four, the first
+// three rows of worldToLocal and then (rootIdx, 0, 0, 0). See Scene.hpp.
+uniform samplerBuffer sceneBvh;
+uniform samplerBuffer sceneInstances;
+
+const uint MAX_BVH_STACK_SIZE = 64;
+const float NO_HIT = 1e30f;
+
+float intersectBox(vec3 p, vec3 invD, float tmin, vec3 boxMin, vec3 boxMax) {
+        vec3 t0 = (boxMin - p) * invD;
+        vec3 t1 = (boxMax - p) * invD;
+        vec3 tnear = min(t0, t1);
+        vec3 tfar = max(t0, t1);
+        float enter = max(max(tnear.x, tnear.y), max(tnear.z, tmin));
+        float exit = min(min(tfar.x, tfar.y), tfar.z);
+        return enter <= exit ? enter : NO_HIT;
+}
+
+float intersectBvhNode(uint nodeIdx, vec3 p, vec3 invD, float tmin) {
+        vec4 lo = texelFetch(sceneBvh, int(2*nodeIdx));
+        vec4 hi = texelFetch(sceneBvh, int(2*nodeIdx + 1));
+        return intersectBox(p, invD, tmin, lo.xyz, hi.xyz);
+}
+
+float sceneRaycast(vec3 p, vec3 d, float tmin, out uint hitNode, out uint hitRank) {
+        vec3 invD = 1.0f / d;
+        float bestT = NO_HIT;
+
+        uint stack[MAX_BVH_STACK_SIZE];
+        uint stackSize = 0;
+        if (textureSize(sceneBvh) > 0) { stack[stackSize++] = 0; }
+        while (stackSize > 0) {
+                uint nodeIdx = stack[--stackSize];
+                if (intersectBvhNode(nodeIdx, p, invD, tmin) >= bestT) { continue; }
+
+                uint leftOrFirst = floatBitsToUint(texelFetch(sceneBvh, int(2*nodeIdx)).w);
+                uint count = floatBitsToUint(texelFetch(sceneBvh, int(2*nodeIdx + 1)).w);
+                if (count > 0) {
+                        for (uint i = leftOrFirst; i < leftOrFirst + count; i++) {
+                                vec4 row0 = texelFetch(sceneInstances, int(4*i));
+                                vec4 row1 = texelFetch(sceneInstances, int(4*i + 1));
+                                vec4 row2 = texelFetch(sceneInstances, int(4*i + 2));
+                                uint rootIdx = floatBitsToUint(texelFetch(sceneInstances, int(4*i + 3)).x);
+                                vec3 localP = vec3(dot(row0, vec4(p, 1)), dot(row1, vec4(p, 1)), dot(row2, vec4(p, 1)));
+                                vec3 localD = vec3(dot(row0, vec4(d, 0)), dot(row1, vec4(d, 0)), dot(row2, vec4(d, 0)));
+                                uint node, rank;
+                                float t = raycast(rootIdx, localP, localD, tmin, bestT, node, rank);
+                                if (t >= 0 && t < bestT) {
+                                        bestT = t;
+                                        hitNode = node;
+                                        hitRank = rank;
+                                }
+                        }
+                        continue;
+                }
+
+                // Visit the nearer child first.
+                uint nearChild = leftOrFirst;
+                uint farChild = leftOrFirst + 1;
+                if (intersectBvhNode(farChild, p, invD, tmin) < intersectBvhNode(nearChild, p, invD, tmin)) {
+                        nearChild = leftOrFirst + 1;
+                        farChild = leftOrFirst;
+                }
+                stack[stackSize++] = farChild;
+                stack[stackSize++] = nearChild;
+        }
+        return bestT == NO_HIT ? -1.0f : bestT;
+}
+
+// Per-voxel attributes, fetched once per pixel after traversal. attributePtrs
+// runs parallel to nodePool; see VoxelAttributes in VoxelOctree.hpp.
+uniform usamplerBuffer attributePtrs;
+uniform usamplerBuffer attributeIndices;
+uniform samplerBuffer attributePalettes;
+
+const uint NO_ATTRIBUTES = 0xFFFFFFFFu;
+
+// Color in rgb, material id / 255 in a.
+vec4 getAttribute(uint nodeIdx, uint rank) {
+        uvec2 ptr = texelFetch(attributePtrs, int(nodeIdx)).rg;
+        if (ptr.x == NO_ATTRIBUTES) { return vec4(1, 1, 1, 0); }
+        uint index = texelFetch(attributeIndices, int(ptr.x + rank)).r;
+        return texelFetch(attributePalettes, int(ptr.y + index));
+}
+
+vec4 colorFromRay(vec3 p, vec3 d, float tmin, out float t) {
         vec3 sunColor = vec3(1,0.97,0.87);
         vec3 ambientColor = vec3(0.1,0.2,0.3);
         vec3 skyColor = vec3(0.3, 0.6, 0.8);
-        vec3 baseColor = vec3(1);
 
-        float t = raycast(p, d);
-        if (t == -1.0f) { return vec4(skyColor * baseColor, 1); }
+        uint hitNode, hitRank;
+        t = sceneRaycast(p, d, tmin, hitNode, hitRank);
+        if (t == -1.0f) { return vec4(skyColor, 1); }
+        vec3 baseColor = getAttribute(hitNode, hitRank).rgb;
         vec3 sunDir = normalize(vec3(0.5, 0.5, 0.5));
         vec3 rayEnd = p + d*t;
-        float t2 = raycast(rayEnd + sunDir * exp2(-20), sunDir);
+        float t2 = sceneRaycast(rayEnd + sunDir * exp2(-20), sunDir, 0.0f, hitNode, hitRank);
         if(t2 == -1) { t2 = 1; }
         return vec4(mix(ambientColor, sunColor, clamp(t2,0,1)) * baseColor.rgb, 1);
 }
 
 vec4 depthColorFromRay(vec3 p, vec3 d) {
-        return vec4(vec3(raycast(p, d)), 1);
+        uint hitNode, hitRank;
+        return vec4(vec3(sceneRaycast(p, d, 0.0f, hitNode, hitRank)), 1);
+}
+
+// Temporal reprojection: every frame writes its primary hit distances to
+// hitDistances, VoxelReprojectComp.glsl moves them into the next frame's view
+// and primary rays start a little in front of the nearest one around their
+// pixel. Any pixel nearby without a sample (a disocclusion, the screen edge or
+// the sky) means starting at the camera. See CpuRenderer.hpp.
+layout(r32f, binding = 0) uniform writeonly image2D hitDistances;
+layout(r32ui, binding = 1) uniform readonly uimage2D startDistances;
+uniform bool useReprojection = false;
+uniform ivec2 renderSize; // The images can be larger than the frame.
+
+const uint NO_SAMPLE = 0x7F800000u; // +infinity, what startDistances is cleared to.
+const float REPROJECTION_MARGIN = 1.0f / 512.0f;
+const float REPROJECTION_RELATIVE_MARGIN = 0.01f;
+
+float getStartT(ivec2 pixel) {
+        if (!useReprojection) { return 0.0f; }
+        float nearest = NO_HIT;
+        for (int dy = -1; dy <= 1; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                        ivec2 neighbour = pixel + ivec2(dx, dy);
+                        if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, renderSize))) { return 0.0f; }
+                        uint bits = imageLoad(startDistances, neighbour).r;
+                        if (bits == NO_SAMPLE) { return 0.0f; }
+                        nearest = min(nearest, uintBitsToFloat(bits));
+                }
+        }
+        return max(0.0f, nearest * (1.0f - REPROJECTION_RELATIVE_MARGIN) - REPROJECTION_MARGIN);
 }
 
 #define M_PI 3.1415926535897932384626433832795
@@ -239,7 +436,10 @@ void main() {
         // color = vec4(vec3(d), 1);
         // return;
 
-        color = colorFromRay(p, d);
+        ivec2 pixel = ivec2(gl_FragCoord.xy);
+        float t;
+        color = colorFromRay(p, d, getStartT(pixel), t);
+        imageStore(hitDistances, pixel, vec4(t));
         // vec4 color1 = depthColorFromRay(p, d);
         // _d = camera * vec4(_position.x + 0.5/1024, 1, _position.y * 3/4 + 0.5/768, 1);
         // d = normalize((vec3(_d) / _d.w) - p);
@@ -0,0 +1,642 @@
+#include "Timer/Timer.hpp"
+#include "Camera.hpp"
+#include "types.hpp"
+
+#include "VoxelOctree.hpp"
+#include "OctreeArchive.hpp"
+#include "Scene.hpp"
+#include "CpuRenderer.hpp"
+#include "FrameGovernor.hpp"
+#include "OctreeCsg.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Offline measurements of the CPU traversal code. Run as
+//   voxbench <benchmark> [args...]
+
+using ms = std::chrono::duration<double, std::milli>;
+
+struct TraceStats {
+        uint64 rays = 0;
+        uint64 hits = 0;
+        uint64 steps = 0;
+        Clock::duration time = Clock::duration::zero();
+
+        void print() const {
+                std::cout << rays << " rays in " << ms(time).count() << " ms ("
+                          << rays / std::chrono::duration<double>(time).count() * 1e-6 << " Mrays/s), "
+                          << double(hits) / rays * 100.0 << "% hit, "
+                          << double(steps) / rays << " steps/ray" << std::endl;
+        }
+};
+
+// Hardware cache misses of this thread, where the kernel lets us count them.
+class CacheMissCounter {
+public:
+        CacheMissCounter() {
+#ifdef __linux__
+                perf_event_attr attr = {};
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+        ~CacheMissCounter() {
+#ifdef __linux__
+                if (fd >= 0) { close(fd); }
+#endif
+        }
+
+        bool isAvailable() const { return fd >= 0; }
+
+        void start() {
+#ifdef __linux__
+                if (fd < 0) { return; }
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+        }
+
+        uint64 stop() {
+                uint64 count = 0;
+#ifdef __linux__
+                if (fd < 0) { return 0; }
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &count, sizeof(count)) != sizeof(count)) { count = 0; }
+#endif
+                return count;
+        }
+
+private:
+        int fd = -1;
+};
+
+// Primary rays for every pixel of a width x height image, as the shader casts them.
+template<typename TraceF>
+TraceStats tracePrimaryRays(const Camera& camera, uint width, uint height, TraceF trace) {
+        TraceStats stats;
+        Timer timer;
+        for (uint y = 0; y < height; y++) {
+                for (uint x = 0; x < width; x++) {
+                        auto screenPos = glm::vec2((x + 0.5f) / width * 2.0f - 1.0f, (y + 0.5f) / height * 2.0f - 1.0f);
+                        Raycast::Hit hit = trace(camera.position, camera.getRayDir(screenPos));
+                        stats.rays++;
+                        stats.hits += hit.t >= 0.0f;
+                        stats.steps += hit.steps;
+                }
+        }
+        stats.time = timer.elapsed();
+        return stats;
+}
+
+// A square grid of randomly rotated copies of one terrain asset, seen at a
+// grazing angle from one corner.
+int benchInstances(uint count) {
+        auto asset = VoxelOctree::create(7);
+
+        Scene scene;
+        uint assetId = scene.addAsset(asset);
+        uint side = std::ceil(std::sqrt(float(count)));
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> angle(0.0f, 2.0f * M_PI);
+        for (uint i = 0; i < count; i++) {
+                auto offset = glm::vec3(i % side, i / side, 0.0f) * 1.25f;
+                auto localToWorld = glm::translate(offset + glm::vec3(0.5f, 0.5f, 0.0f))
+                        * rotatez(angle(rng))
+                        * glm::translate(glm::vec3(-0.5f, -0.5f, 0.0f));
+                scene.addInstance(assetId, localToWorld);
+        }
+
+        Timer buildTimer;
+        scene.build();
+        auto buildTime = buildTimer.elapsed();
+
+        auto camera = Camera::create();
+        camera.position = glm::vec3(-2.0f, -2.0f, 3.0f);
+        camera.rotation = glm::vec2(M_PI / 4.0f, -0.5f);
+
+        std::cout << count << " instances of a " << asset.nodes.size() << " node asset, "
+                  << scene.bvh.size() << " BVH nodes built in " << ms(buildTime).count() << " ms" << std::endl;
+        std::cout << "memory: " << scene.memoryBytes() << " bytes shared, "
+                  << uint64(asset.nodes.size()) * sizeof(NodeOrFarPtr) * count << " bytes if baked per copy" << std::endl;
+
+        auto stats = tracePrimaryRays(camera, 256, 192, [&](glm::vec3 p, glm::vec3 d) {
+                return scene.raycast(p, d);
+        });
+        stats.print();
+        return 0;
+}
+
+// The same terrain with and without 4x4x4 leaf bricks, traced from the same
+// camera. Both layouts should produce the same image.
+int benchBricks(uint depth) {
+        auto camera = Camera::create();
+        camera.position = glm::vec3(0.5f, -0.2f, 0.9f);
+        camera.rotation = glm::vec2(0.0f, -0.7f);
+
+        std::vector<float> hitTs[2];
+        for (bool useBricks : {false, true}) {
+                auto oct = VoxelOctree::create(depth, useBricks);
+                std::cout << (useBricks ? "bricks:    " : "no bricks: ") << oct.nodes.size() << " entries, "
+                          << oct.nodes.size() * sizeof(NodeOrFarPtr) << " bytes" << std::endl;
+
+                auto& ts = hitTs[useBricks];
+                auto stats = tracePrimaryRays(camera, 512, 384, [&](glm::vec3 p, glm::vec3 d) {
+                        auto hit = Raycast::raycast(oct.nodes.data(), 0, p, d);
+                        ts.push_back(hit.t);
+                        return hit;
+                });
+                stats.print();
+        }
+
+        uint mismatches = 0;
+        for (uint i = 0; i < hitTs[0].size(); i++) {
+                mismatches += std::abs(hitTs[0][i] - hitTs[1][i]) > 1e-5f;
+        }
+        std::cout << mismatches << " of " << hitTs[0].size() << " pixels differ" << std::endl;
+        return 0;
+}
+
+// Short fly-throughs over the terrain, each rendered once from scratch every
+// frame and once with primary rays starting at the reprojected hit distances
+// of the frame before.
+int benchReprojection(uint frames) {
+        auto oct = VoxelOctree::create(10, true);
+        Scene scene;
+        scene.addInstance(scene.addAsset(oct), glm::mat4(1.0f));
+        scene.build();
+
+        float speed = std::exp2(-8.0f);
+        float rotSpeed = M_PI / 256.0f;
+        std::vector<std::pair<std::string, std::function<void(Camera&)>>> paths = {
+                {"forward", [&](Camera& camera) { camera.move(glm::vec3(0.0f, speed, 0.0f)); }},
+                {"strafe", [&](Camera& camera) { camera.move(glm::vec3(speed, 0.0f, 0.0f)); }},
+                {"turn", [&](Camera& camera) { camera.rotation.x += rotSpeed; }},
+                {"dive", [&](Camera& camera) {
+                        camera.move(glm::vec3(0.0f, speed, 0.0f));
+                        camera.rotation.y -= rotSpeed * 0.5f;
+                }},
+        };
+
+        for (auto& path : paths) {
+                CpuRenderer renderers[2] = {{256, 192}, {256, 192}};
+                renderers[1].useReprojection = true;
+                CpuRenderer::FrameStats totals[2];
+                uint64 mismatches = 0;
+
+                auto camera = Camera::create();
+                camera.position = glm::vec3(0.5f, 0.1f, 0.8f);
+                camera.rotation = glm::vec2(0.0f, -0.5f);
+                for (uint frame = 0; frame < frames; frame++) {
+                        for (uint i : {0, 1}) {
+                                auto stats = renderers[i].render(scene, camera);
+                                // The first frame has nothing to reproject.
+                                if (frame == 0) { continue; }
+                                totals[i].primaryRays += stats.primaryRays;
+                                totals[i].primarySteps += stats.primarySteps;
+                                totals[i].reprojectedRays += stats.reprojectedRays;
+                                totals[i].time += stats.time;
+                        }
+                        for (uint j = 0; j < renderers[0].hitTs.size(); j++) {
+                                mismatches += std::abs(renderers[0].hitTs[j] - renderers[1].hitTs[j]) > 1e-5f;
+                        }
+                        path.second(camera);
+                }
+
+                std::cout << path.first << ":" << std::endl;
+                for (uint i : {0, 1}) {
+                        auto& total = totals[i];
+                        std::cout << (i ? "  reprojected: " : "  full:        ")
+                                  << double(total.primarySteps) / total.primaryRays << " steps/primary ray, "
+                                  << double(total.reprojectedRays) / total.primaryRays * 100.0 << "% warm started, "
+                                  << ms(total.time).count() / (frames - 1) << " ms/frame" << std::endl;
+                }
+                std::cout << "  " << mismatches << " of " << uint64(frames) * renderers[0].hitTs.size()
+                          << " hits differ" << std::endl;
+        }
+        return 0;
+}
+
+// Memory taken by the palette compressed attribute stream, and node array
+// reads per primary ray with and without attributes to show that traversal
+// doesn't touch them.
+int benchAttributes(uint depth) {
+        Timer buildTimer;
+        auto oct = VoxelOctree::create(depth, true);
+        auto buildTime = buildTimer.elapsed();
+
+        auto& attributes = oct.attributes;
+        std::set<uint32> palettes;
+        for (auto& ptr : attributes.ptrs) {
+                if (ptr.attributeIdx != VoxelAttributes::NONE) { palettes.insert(ptr.paletteIdx); }
+        }
+        std::cout << "built in " << ms(buildTime).count() << " ms" << std::endl;
+        std::cout << "nodes:      " << oct.nodes.size() * sizeof(NodeOrFarPtr) << " bytes" << std::endl;
+        std::cout << "attributes: " << attributes.bytes() << " bytes ("
+                  << attributes.ptrs.size() * sizeof(VoxelAttributes::Ptr) << " pointers, "
+                  << attributes.indices.size() << " indices, "
+                  << palettes.size() << " palettes of " << double(attributes.palettes.size()) / palettes.size()
+                  << " colors on average)" << std::endl;
+        std::cout << "unpaletted: " << attributes.ptrs.size() * sizeof(uint32) + attributes.indices.size() * sizeof(uint32)
+                  << " bytes" << std::endl;
+
+        auto camera = Camera::create();
+        camera.position = glm::vec3(0.5f, -0.2f, 0.9f);
+        camera.rotation = glm::vec2(0.0f, -0.7f);
+        for (bool useAttributes : {false, true}) {
+                Scene scene;
+                VoxelOctree asset;
+                asset.nodes = oct.nodes;
+                if (useAttributes) { asset.attributes = oct.attributes; }
+                scene.addInstance(scene.addAsset(asset), glm::mat4(1.0f));
+                scene.build();
+
+                CpuRenderer renderer{512, 384};
+                auto stats = renderer.render(scene, camera);
+                uint64 hits = stats.primaryHits;
+                std::cout << (useAttributes ? "attributes:    " : "no attributes: ")
+                          << double(stats.primaryFetches) / stats.primaryRays << " node fetches/ray, "
+                          << double(stats.attributeFetches) / hits << " attribute fetches/hit, "
+                          << ms(stats.time).count() << " ms" << std::endl;
+        }
+        return 0;
+}
+
+// A dive from a view of the horizon down into the terrain, which gets more
+// expensive as the ground fills the screen, rendered once at full resolution
+// and once with the governor picking the resolution to stay under a budget.
+int benchGovernor(uint frames) {
+        auto oct = VoxelOctree::create(9, true);
+        Scene scene;
+        scene.addInstance(scene.addAsset(oct), glm::mat4(1.0f));
+        scene.build();
+
+        const uint width = 320;
+        const uint height = 240;
+        const auto target = std::chrono::milliseconds(25);
+        std::vector<glm::vec4> upscaled;
+        for (bool useGovernor : {false, true}) {
+                CpuRenderer renderer{width, height};
+                renderer.useReprojection = true;
+                FrameGovernor governor{target};
+
+                auto camera = Camera::create();
+                camera.position = glm::vec3(0.5f, -0.3f, 0.9f);
+                camera.rotation = glm::vec2(0.0f, 0.0f);
+                uint overBudget = 0;
+                double totalScale = 0.0;
+                std::cout << (useGovernor ? "governed:" : "full resolution:") << std::endl;
+                for (uint frame = 0; frame < frames; frame++) {
+                        float scale = governor.getScale();
+                        renderer.setResolution(governor.getScaled(width), governor.getScaled(height));
+                        Timer timer;
+                        renderer.render(scene, camera);
+                        renderer.upscale(width, height, upscaled);
+                        auto time = timer.elapsed();
+                        if (useGovernor) { governor.update(scale, time); }
+
+                        overBudget += time > target;
+                        totalScale += scale;
+                        if (frame % 10 == 0) {
+                                std::cout << "  frame " << frame << ": " << renderer.width << "x" << renderer.height
+                                          << " in " << ms(time).count() << " ms" << std::endl;
+                        }
+                        camera.move(glm::vec3(0.0f, 0.5f, 0.0f) / float(frames));
+                        camera.rotation.y -= 1.0f / frames;
+                }
+                std::cout << "  " << overBudget << " of " << frames << " frames over " << ms(target).count()
+                          << " ms, average scale " << totalScale / frames << std::endl;
+        }
+        return 0;
+}
+
+// The same frame with its shadow and ambient occlusion rays traced in the
+// order their primary rays hit and sorted for coherence. Both orders should
+// produce the same image.
+int benchSecondary(uint aoSamples) {
+        auto oct = VoxelOctree::create(10, true);
+        Scene scene;
+        scene.addInstance(scene.addAsset(oct), glm::mat4(1.0f));
+        scene.build();
+
+        auto camera = Camera::create();
+        camera.position = glm::vec3(0.5f, -0.2f, 0.9f);
+        camera.rotation = glm::vec2(0.0f, -0.7f);
+
+        CacheMissCounter cacheMisses;
+        if (!cacheMisses.isAvailable()) {
+                std::cout << "no hardware cache miss counter (perf_event_open failed)" << std::endl;
+        }
+
+        std::vector<glm::vec4> images[2];
+        for (bool sorted : {false, true}) {
+                CpuRenderer renderer{512, 384};
+                renderer.aoSamples = aoSamples;
+                renderer.sortSecondaryRays = sorted;
+                // Warm up, then measure a second frame.
+                renderer.render(scene, camera);
+                cacheMisses.start();
+                auto stats = renderer.render(scene, camera);
+                uint64 misses = cacheMisses.stop();
+
+                double seconds = std::chrono::duration<double>(stats.secondaryTime).count();
+                std::cout << (sorted ? "sorted:   " : "unsorted: ")
+                          << stats.secondaryRays << " secondary rays in " << ms(stats.secondaryTime).count() << " ms ("
+                          << stats.secondaryRays / seconds * 1e-6 << " Mrays/s), sort "
+                          << ms(stats.sortTime).count() << " ms, "
+                          << double(stats.secondaryFetches) / stats.secondaryRays << " fetches/ray, ";
+                if (cacheMisses.isAvailable()) {
+                        std::cout << double(misses) / stats.secondaryRays << " cache misses/ray";
+                }
+                else {
+                        std::cout << "cache misses n/a";
+                }
+                std::cout << ", frame " << ms(stats.time).count() << " ms" << std::endl;
+                images[sorted] = renderer.colors;
+        }
+
+        uint mismatches = 0;
+        for (uint i = 0; i < images[0].size(); i++) {
+                mismatches += images[0][i] != images[1][i];
+        }
+        std::cout << mismatches << " of " << images[0].size() << " pixels differ" << std::endl;
+        return 0;
+}
+
+bool sameNodes(const VoxelOctree& a, const VoxelOctree& b) {
+        return a.nodes.size() == b.nodes.size()
+            && std::equal(a.nodes.begin(), a.nodes.end(), b.nodes.begin(), [](auto x, auto y) {
+                return x.farptr == y.farptr;
+        });
+}
+
+// Whether two octrees with the same nodes give every solid child and brick
+// voxel the same attribute. Where the indices and palettes lie may differ.
+bool sameAttributes(const VoxelOctree& a, const VoxelOctree& b) {
+        if (a.attributes.ptrs.empty() != b.attributes.ptrs.empty()) { return false; }
+        if (a.attributes.ptrs.empty()) { return true; }
+        auto counts = a.getAttributeCounts();
+        for (uint nodeIdx = 0; nodeIdx < counts.size(); nodeIdx++) {
+                for (uint rank = 0; rank < counts[nodeIdx]; rank++) {
+                        if (a.attributes.lookup(nodeIdx, rank) != b.attributes.lookup(nodeIdx, rank)) { return false; }
+                }
+        }
+        return true;
+}
+
+// Whether an octree comes back unchanged from an in-memory archive.
+bool archiveRoundTrips(const VoxelOctree& oct) {
+        std::stringstream stream;
+        OctreeArchive::compress(oct).write(stream);
+        auto result = OctreeArchive::read(stream).decompress();
+        return sameNodes(oct, result) && sameAttributes(oct, result);
+}
+
+// The voxel at (x, y, z) of an octree with its voxels at depth, and its
+// attribute, found by walking down from the root.
+bool getVoxel(const VoxelOctree& oct, uint depth, uint x, uint y, uint z, uint32& attribute) {
+        auto lookup = [&](uint nodeIdx, uint rank) {
+                return oct.attributes.ptrs.empty() ? VoxelAttributes::DEFAULT : oct.attributes.lookup(nodeIdx, rank);
+        };
+        uint nodeIdx = 0;
+        for (uint level = 0; level < depth; level++) {
+                uint shift = depth - level - 1;
+                uint octant = (x >> shift & 1) | (y >> shift & 1) << 1 | (z >> shift & 1) << 2;
+                const VoxelNode& node = oct.nodes[nodeIdx].node;
+                uint8 bit = 1 << octant;
+                uint8 solidMask = node.validMask & node.leafMask;
+                if (solidMask & bit) {
+                        attribute = lookup(nodeIdx, popCount(solidMask & (bit - 1)));
+                        return true;
+                }
+                if (node.getBrickMask() & bit) {
+                        uint brickIdx = oct.getChildIdx(nodeIdx, octant);
+                        uint64 brick = oct.getBrick(brickIdx);
+                        uint brickBitIdx = brickBit(x & 3, y & 3, z & 3);
+                        if (!(brick >> brickBitIdx & 1)) { return false; }
+                        attribute = lookup(brickIdx, popCount64(brick & ((uint64(1) << brickBitIdx) - 1)));
+                        return true;
+                }
+                if (!(node.getNodeMask() & bit)) { return false; }
+                nodeIdx = oct.getChildIdx(nodeIdx, octant);
+        }
+        return false;
+}
+
+// One CSG operation on the terrain, with what b looks like voxel by voxel
+// and the box its voxels lie in.
+struct CsgCase {
+        std::string name;
+        Csg::Op op;
+        std::function<VoxelOctree(Csg::Stats*, uint)> apply;
+        std::function<bool(uint, uint, uint, uint32&)> getB;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+};
+
+// Compares a result with the operation worked out voxel by voxel, at samples
+// random voxels of the whole octree and as many inside b's bounds. Solid
+// voxels take the attribute of the side they come from; where both sides are
+// solid a union may take either.
+void checkCsg(const CsgCase& c, const VoxelOctree& a, const VoxelOctree& result, uint depth, uint samples,
+              uint& occupancyMismatches, uint& attributeMismatches) {
+        occupancyMismatches = 0;
+        attributeMismatches = 0;
+        uint size = 1u << depth;
+        uint lo[3], hi[3];
+        for (int axis : range(0,3)) {
+                lo[axis] = std::min(std::max(c.boundsMin[axis], 0.0f), 1.0f) * (size - 1);
+                hi[axis] = std::min(std::max(c.boundsMax[axis], 0.0f), 1.0f) * (size - 1);
+        }
+        std::mt19937 rng(1);
+        for (uint i = 0; i < 2 * samples; i++) {
+                uint v[3];
+                for (int axis : range(0,3)) {
+                        v[axis] = i < samples ? rng() % size : lo[axis] + rng() % (hi[axis] - lo[axis] + 1);
+                }
+                uint x = v[0], y = v[1], z = v[2];
+                uint32 aAttribute = 0, bAttribute = 0, attribute = 0;
+                bool inA = getVoxel(a, depth, x, y, z, aAttribute);
+                bool inB = c.getB(x, y, z, bAttribute);
+                bool expected = c.op == Csg::UNION ? inA || inB : c.op == Csg::SUBTRACT ? inA && !inB : inA && inB;
+                bool actual = getVoxel(result, depth, x, y, z, attribute);
+                if (actual != expected) {
+                        occupancyMismatches++;
+                        continue;
+                }
+                if (!actual) { continue; }
+                bool fromA = inA && attribute == aAttribute;
+                bool fromB = c.op == Csg::UNION && inB && attribute == bAttribute;
+                if (!fromA && !fromB) { attributeMismatches++; }
+        }
+}
+
+// Carving shapes out of the terrain and stamping shapes and another octree
+// into it, next to the time it takes to build the terrain. Spheres of growing
+// radius show the work following their surface rather than their volume.
+// Every result is checked against a per-voxel reference and a round trip
+// through an archive.
+int benchCsg(uint depth) {
+        Timer buildTimer;
+        auto terrain = VoxelOctree::create(depth, true);
+        auto buildTime = buildTimer.elapsed();
+        std::cout << "terrain: " << terrain.nodes.size() << " entries, built in " << ms(buildTime).count() << " ms" << std::endl;
+
+        VoxelOctree empty;
+        VoxelNode root = {0, 0, 0};
+        root.setChildPtr(1, false);
+        empty.nodes.push_back(NodeOrFarPtr{root});
+        auto wallColor = packAttribute(0.6f, 0.3f, 0.25f, MATERIAL_ROCK);
+        Csg::Box towerWall{glm::vec3(0.55f, 0.55f, 0.0f), glm::vec3(0.65f, 0.65f, 0.7f), wallColor};
+        Csg::Sphere towerTop{glm::vec3(0.6f, 0.6f, 0.7f), 0.08f, wallColor};
+        auto tower = Csg::applyShape(empty, towerWall, depth, Csg::UNION);
+        tower = Csg::applyShape(tower, towerTop, depth, Csg::UNION);
+
+        float size = float(1u << depth);
+        auto shapeCase = [&](std::string name, auto shape, Csg::Op op, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+                return CsgCase{name, op, [&, shape, op](Csg::Stats* stats, uint numThreads) {
+                        return Csg::applyShape(terrain, shape, depth, op, stats, numThreads);
+                }, [shape, size](uint x, uint y, uint z, uint32& attribute) {
+                        attribute = shape.attribute;
+                        return shape.contains((glm::vec3(x, y, z) + 0.5f) / size);
+                }, boundsMin, boundsMax};
+        };
+        auto octreeCase = [&](std::string name, Csg::Op op) {
+                return CsgCase{name, op, [&, op](Csg::Stats* stats, uint numThreads) {
+                        return Csg::apply(terrain, tower, op, stats, numThreads);
+                }, [&](uint x, uint y, uint z, uint32& attribute) {
+                        return getVoxel(tower, depth, x, y, z, attribute);
+                }, towerWall.min - towerTop.radius, towerWall.max + towerTop.radius};
+        };
+
+        auto center = glm::vec3(0.5f, 0.5f, 0.2f); // On the surface.
+        std::vector<CsgCase> cases;
+        for (float radius : {1.0f / 64.0f, 1.0f / 32.0f, 1.0f / 16.0f, 1.0f / 8.0f}) {
+                cases.push_back(shapeCase("carve sphere r=" + std::to_string(radius), Csg::Sphere{center, radius},
+                                          Csg::SUBTRACT, center - radius, center + radius));
+        }
+        Csg::Box tunnel{glm::vec3(0.0f, 0.47f, 0.03f), glm::vec3(1.0f, 0.53f, 0.06f)};
+        cases.push_back(shapeCase("carve tunnel", tunnel, Csg::SUBTRACT, tunnel.min, tunnel.max));
+        cases.push_back(shapeCase("clip to box", Csg::Box{glm::vec3(0.25f), glm::vec3(0.75f)}, Csg::INTERSECT, glm::vec3(0.0f), glm::vec3(1.0f)));
+        cases.push_back(octreeCase("stamp tower", Csg::UNION));
+        cases.push_back(octreeCase("cut out tower", Csg::SUBTRACT));
+
+        bool ok = true;
+        uint maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (auto& c : cases) {
+                std::cout << c.name << ":" << std::endl;
+                for (uint numThreads : std::set<uint>{1, maxThreads}) {
+                        Csg::Stats stats;
+                        Timer timer;
+                        auto result = c.apply(&stats, numThreads);
+                        auto time = timer.elapsed();
+                        uint occupancyMismatches, attributeMismatches;
+                        checkCsg(c, terrain, result, depth, 1000000, occupancyMismatches, attributeMismatches);
+                        bool roundTrips = archiveRoundTrips(result);
+                        ok = ok && occupancyMismatches == 0 && attributeMismatches == 0 && roundTrips;
+                        std::cout << "  " << numThreads << (numThreads == 1 ? " thread: " : " threads: ") << ms(time).count() << " ms, "
+                                  << stats.visitedCells << " cells visited, "
+                                  << stats.newNodes << " new nodes, " << stats.newBricks << " new bricks, "
+                                  << stats.copiedEntries << " entries copied in " << stats.copiedSubtrees << " subtrees, "
+                                  << result.nodes.size() << " entries, " << result.attributes.bytes() << " bytes of attributes, archive "
+                                  << (roundTrips ? "round trips" : "differs") << std::endl;
+                        std::cout << "    " << occupancyMismatches << " voxels and " << attributeMismatches
+                                  << " attributes differ from the reference" << std::endl;
+                }
+        }
+        return ok ? 0 : 1;
+}
+
+// Writes the terrain to an in-memory archive and reads it back, once per
+// thread count, checking that nodes and attributes survive the round trip.
+int benchArchive(uint depth) {
+        auto oct = VoxelOctree::create(depth, true);
+        Timer compressTimer;
+        auto archive = OctreeArchive::compress(oct);
+        auto compressTime = compressTimer.elapsed();
+        std::stringstream stream;
+        archive.write(stream);
+        std::cout << "compressed " << archive.rawBytes() << " bytes to " << archive.compressedBytes() << " bytes ("
+                  << archive.compressionRatio() << "x, " << archive.indexCount << " attribute indices, "
+                  << archive.blocks.size() << " blocks) in " << ms(compressTime).count() << " ms" << std::endl;
+
+        bool ok = true;
+        uint maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        for (uint numThreads : std::set<uint>{1, maxThreads}) {
+                stream.seekg(0);
+                Timer timer;
+                auto result = OctreeArchive::read(stream).decompress(numThreads);
+                auto time = timer.elapsed();
+                bool nodesMatch = sameNodes(oct, result);
+                bool attributesMatch = sameAttributes(oct, result);
+                ok = ok && nodesMatch && attributesMatch;
+                std::cout << numThreads << (numThreads == 1 ? " thread: " : " threads: ") << ms(time).count() << " ms, nodes "
+                          << (nodesMatch ? "match" : "differ") << ", attributes "
+                          << (attributesMatch ? "match" : "differ") << std::endl;
+        }
+        return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+        std::string benchmark = argc > 1 ? argv[1] : "";
+        if (benchmark == "instances") {
+                return benchInstances(argc > 2 ? std::atoi(argv[2]) : 1000);
+        }
+
+        if (benchmark == "bricks") {
+                return benchBricks(argc > 2 ? std::atoi(argv[2]) : 9);
+        }
+
+        if (benchmark == "reprojection") {
+                return benchReprojection(argc > 2 ? std::atoi(argv[2]) : 30);
+        }
+
+        if (benchmark == "attributes") {
+                return benchAttributes(argc > 2 ? std::atoi(argv[2]) : 10);
+        }
+
+        if (benchmark == "governor") {
+                return benchGovernor(argc > 2 ? std::atoi(argv[2]) : 60);
+        }
+
+        if (benchmark == "secondary") {
+                return benchSecondary(argc > 2 ? std::atoi(argv[2]) : 4);
+        }
+
+        if (benchmark == "csg") {
+                return benchCsg(argc > 2 ? std::atoi(argv[2]) : 9);
+        }
+
+        if (benchmark == "archive") {
+                return benchArchive(argc > 2 ? std::atoi(argv[2]) : 10);
+        }
+
+        std::cerr << "usage: voxbench instances [count]" << std::endl;
+        std::cerr << "       voxbench bricks [depth]" << std::endl;
+        std::cerr << "       voxbench reprojection [frames]" << std::endl;
+        std::cerr << "       voxbench attributes [depth]" << std::endl;
+        std::cerr << "       voxbench governor [frames]" << std::endl;
+        std::cerr << "       voxbench secondary [aoSamples]" << std::endl;
+        std::cerr << "       voxbench csg [depth]" << std::endl;
+        std::cerr << "       voxbench archive [depth]" << std::endl;
+        return 1;
+}
@@ -4,238 +4,121 @@
 #include "Camera.hpp"
 #include "types.hpp"
 
-#include <bitset>
-template <typename T> auto bits(T x) {
-        return std::bitset<sizeof(T)*8>(*(unsigned long long*)&x);
-}
-
-#include "Func/Func.hpp"
-struct PreVoxelOctreeNode {
-        uint childIdxs[8] = {0};
-        uint8 validMask = 0;
-        uint8 leafMask = 0;
-        uint subtreeSize = 0;
-
-        void print() const {
-                std::cout << bits(validMask) << '\t' << bits(leafMask) << '\t' << subtreeSize << std::endl;
-                for (auto i : range(0,8)) {
-                        std::cout << i << ": " << childIdxs[i] << std::endl;
-                }
-        }
-};
-
-#include <vector>
-struct PreVoxelOctree {
-        std::vector<PreVoxelOctreeNode> nodePool;
-
-        template<typename MVoxIterT>
-        bool addSubtree(uint size, MVoxIterT& vox) {
-                if (size == 0) { bool v = *vox; ++vox; return v; }
-
-                uint nodeIdx = nodePool.size();
-                nodePool.emplace_back();
-
-                for(int i = 0; i < 8; i++) {
-                        uint curIdx = nodePool.size();
-                        nodePool[nodeIdx].childIdxs[i] = curIdx;
-
-                        bool isLeaf = addSubtree(size - 1, vox);
-                        if (nodePool.size() != curIdx) {
-                                nodePool[nodeIdx].validMask |= 1 << i;
-                        } else if (isLeaf) {
-                                nodePool[nodeIdx].validMask |= 1 << i;
-                                nodePool[nodeIdx].leafMask |= 1 << i;
-                        }
-                }
-
-                nodePool[nodeIdx].subtreeSize = nodePool.size() - nodeIdx - 1;
-                if (nodePool[nodeIdx].leafMask == u'\xFF') {
-                        if (nodeIdx != 0) nodePool.pop_back();
-                        return true;
-                }
-                else if (nodePool[nodeIdx].validMask == u'\x00') {
-                        if (nodeIdx != 0) nodePool.pop_back();
-                }
-                return false;
-        }
-
-        void print() const {
-                for (auto n : nodePool) { n.print(); }
-        }
-};
-
-#include "Morton.hpp"
-#include "Perlin.hpp"
-struct SimpleMvoxIter {
-        uint64 idx = 0;
-        uint64 offset = 0;
-        mutable Perlin::CachedHeightmapGenerator gen{8};
-
-        bool operator*() const {
-                uint x, y, z;
-                std::tie(x, y, z) = Morton::decode(idx);
-                uint height = gen.getHeight(x, y, z);
-                if (z == 0) { return true; }
-                else if (z < height) { return true; }
-                else { return false; }
-        }
-        void operator++() {
-                ++idx;
-        }
-};
+#include "VoxelOctree.hpp"
+#include "OctreeArchive.hpp"
+#include "Scene.hpp"
+#include "FrameGovernor.hpp"
 
-struct VoxelNode {
-        uint16 _childPtr;
-        uint8 validMask;
-        uint8 leafMask;
-
-        void setChildPtr(uint16 offset, bool far) {
-                _childPtr = offset << 1;
-                if (far) _childPtr |= 1;
-        }
-        uint16 getChildPtr() const {
-                return _childPtr >> 1;
-        }
-
-        void print() const {
-                std::cout << bits(validMask) << '\t';
-                std::cout << bits(leafMask) << '\t';
-                std::cout << getChildPtr() << std::endl;
-        }
-};
-
-union NodeOrFarPtr {
-        VoxelNode node;
-        uint32 farptr;
-};
-
-uint8 popCount(uint8 x) {
-        x -= (x >> 1) & '\x55';
-        x = (x & '\x33') + ((x >> 2) & '\x33');
-        return (x + (x >> 4)) & 0x0f;
-}
-
-struct VoxelOctree {
-        std::vector<NodeOrFarPtr> nodes;
-
-        static VoxelOctree create() {
-                VoxelOctree self;
-                PreVoxelOctree preOct;
-                SimpleMvoxIter iter;
-
-                preOct.addSubtree(10, iter);
-
-                VoxelNode root;
-                root.validMask = preOct.nodePool[0].validMask;
-                root.leafMask = preOct.nodePool[0].leafMask;
-                root.setChildPtr(1, false);
-                self.nodes.push_back(NodeOrFarPtr{root});
-                self.addSubtree(preOct, 0, 0);
-
-                return self;
-        }
-
-        void addSubtree(PreVoxelOctree& preOct, uint curPreIdx, uint curNodeIdx) {
-                uint startPos = nodes.size();
-
-                PreVoxelOctreeNode& curPreNode = preOct.nodePool[curPreIdx];
-                auto validNonLeaves = curPreNode.validMask ^ curPreNode.leafMask;
-                auto isValidNonLeaf = [&](auto i) -> bool { return validNonLeaves & 1 << i; };
-                for (int i : filter(isValidNonLeaf, range(0,8))) {
-                        auto& curPreChild = preOct.nodePool[curPreNode.childIdxs[i]];
-                        VoxelNode node;
-                        node.validMask = curPreChild.validMask;
-                        node.leafMask = curPreChild.leafMask;
-                        nodes.push_back(NodeOrFarPtr{node});
-                }
-
-                uint sum = 0;
-                uint farPtrs[8] = {0};
-                for (int i : filter(isValidNonLeaf, range(0, 8))) {
-                        uint8 bitmask = uint8(~0) >> (8 - i);
-                        auto numPrevChildren = popCount(validNonLeaves & bitmask);
-                        auto childIdx = startPos + numPrevChildren;
-                        auto offset = sum + nodes.size() - childIdx;
-                        if (offset > 0x7fff) {
-                                farPtrs[i] = nodes.size();
-                                nodes.push_back(NodeOrFarPtr{{0}});
-                                continue;
-                        }
-                        sum += preOct.nodePool[curPreNode.childIdxs[i]].subtreeSize;
-                }
-
-                for (int i : filter(isValidNonLeaf, range(0,8))) {
-                        uint8 bitmask = uint8(~0) >> (8 - i);
-                        auto numPrevChildren = popCount(validNonLeaves & bitmask);
-                        auto childIdx = startPos + numPrevChildren;
-
-                        if (farPtrs[i] == 0) {
-                                nodes[childIdx].node.setChildPtr(nodes.size() - childIdx, false);
-                        }
-                        else {
-                                nodes[childIdx].node.setChildPtr(farPtrs[i] - childIdx, true);
-                                nodes[farPtrs[i]].farptr = nodes.size() - farPtrs[i];
-                        }
-                        addSubtree(preOct, curPreNode.childIdxs[i], childIdx);
-                }
-        }
-
-        void print() const {
-                for (auto n : nodes) {
-                        n.node.print();
-                }
-        }
-};
-
-#include <cerrno>
+#include <cstdlib>
 #include <fstream>
-
-std::string readFile(const char *filename)
-{
-        std::ifstream in(filename, std::ios::in | std::ios::binary);
-        if (in) {
-                std::string contents;
-                in.seekg(0, std::ios::end);
-                contents.resize(in.tellg());
-                in.seekg(0, std::ios::beg);
-                in.read(&contents[0], contents.size());
-                in.close();
-                return(contents);
-        }
-        throw(errno);
-}
-
+#include "VoxelShaderVert.hpp"
+#include "VoxelShaderFrag.hpp"
+#include "VoxelReprojectComp.hpp"
 
 class VoxelRenderer {
 private:
         GLFWwindow* window;
         GLLib::Buffer octreeBuffer = GLLib::Buffer::create();
         GLuint octreeTexture = 0;
+        GLLib::Buffer bvhBuffer = GLLib::Buffer::create();
+        GLuint bvhTexture = 0;
+        GLLib::Buffer instanceBuffer = GLLib::Buffer::create();
+        GLuint instanceTexture = 0;
+        GLLib::Buffer attributePtrBuffer = GLLib::Buffer::create();
+        GLuint attributePtrTexture = 0;
+        GLLib::Buffer attributeIndexBuffer = GLLib::Buffer::create();
+        GLuint attributeIndexTexture = 0;
+        GLLib::Buffer paletteBuffer = GLLib::Buffer::create();
+        GLuint paletteTexture = 0;
         GLLib::Buffer quadBuffer = GLLib::Buffer::create();
         GLLib::Buffer quadIdxBuffer = GLLib::Buffer::create();
         GLLib::Program program;
         GLLib::VertexArray vao = GLLib::VertexArray::create();
+        GLint cameraLoc = -1;
+        GLint nodePoolLoc = -1;
+        GLint sceneBvhLoc = -1;
+        GLint sceneInstancesLoc = -1;
+        GLint attributePtrsLoc = -1;
+        GLint attributeIndicesLoc = -1;
+        GLint attributePalettesLoc = -1;
+        GLint useReprojectionLoc = -1;
+
+        // Temporal reprojection of primary hit distances, see
+        // VoxelReprojectComp.glsl.
+        GLLib::Program reprojectProgram;
+        GLuint hitTexture = 0;
+        GLuint startTexture = 0;
+        GLint prevCameraLoc = -1;
+        GLint cameraInverseLoc = -1;
+        GLint prevRenderSizeLoc = -1;
+        GLint reprojectRenderSizeLoc = -1;
+        glm::mat4 prevCameraTransform;
+        int prevRenderWidth = 0;
+        int prevRenderHeight = 0;
+        bool hasPrevFrame = false;
+
+        // Frames are ray cast into the lower left corner of sceneFramebuffer
+        // at the governor's scale and then stretched over the window. Their
+        // GPU time is measured with a ring of timer queries, each read back
+        // TIME_QUERY_COUNT - 1 frames later so that nothing waits on the GPU.
+        static constexpr uint TIME_QUERY_COUNT = 3;
+        GLuint sceneFramebuffer = 0;
+        GLuint sceneColorTexture = 0;
+        GLuint timeQueries[TIME_QUERY_COUNT] = {0};
+        float queryScales[TIME_QUERY_COUNT] = {0};
+        uint64 frameCount = 0;
+        GLint renderSizeLoc = -1;
+        int width = 0;
+        int height = 0;
 
         VoxelRenderer(GLFWwindow* window): window(window) {}
 public:
-        static VoxelRenderer create(GLFWwindow* window) {
+        struct ProgramLoadStats {
+                bool cacheHit;
+                Clock::duration time;
+        };
+        ProgramLoadStats programLoadStats = {false, Clock::duration::zero()};
+        bool useReprojection = true;
+        FrameGovernor governor{std::chrono::microseconds(12000)};
+
+        static VoxelRenderer create(GLFWwindow* window, const GLLib::ProgramCache& programCache) {
                 glEnable(GL_BLEND);
                 glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
                 auto self = VoxelRenderer{window};
-                self.initProgram();
+                glfwGetFramebufferSize(window, &self.width, &self.height);
+                self.initProgram(programCache);
+                self.initReprojection(programCache);
+                self.initSceneFramebuffer();
 
                 return self;
         }
 
-        void initProgram() {
-                auto vert = GLLib::Shader::fromString(GL_VERTEX_SHADER, readFile("../src/VoxelShaderVert.glsl").c_str());
-                auto frag = GLLib::Shader::fromString(GL_FRAGMENT_SHADER, readFile("../src/VoxelShaderFrag.glsl").c_str());
-                for (auto& shad : {vert, frag}) {
-                        program.addShader(shad);
+        void initProgram(const GLLib::ProgramCache& programCache) {
+                Timer timer;
+                auto key = GLLib::ProgramCache::getKey({VoxelShaderVert, VoxelShaderFrag});
+                bool cacheHit = programCache.load(program, key);
+                if (!cacheHit) {
+                        auto vert = GLLib::Shader::fromString(GL_VERTEX_SHADER, VoxelShaderVert);
+                        auto frag = GLLib::Shader::fromString(GL_FRAGMENT_SHADER, VoxelShaderFrag);
+                        for (auto& shad : {vert, frag}) {
+                                program.addShader(shad);
+                        }
+                        program.setBinaryRetrievable();
+                        program.link();
+                        programCache.store(program, key);
                 }
-                program.link();
                 program.use();
+                cameraLoc = program.getUniformLoc("camera");
+                nodePoolLoc = program.getUniformLoc("nodePool");
+                sceneBvhLoc = program.getUniformLoc("sceneBvh");
+                sceneInstancesLoc = program.getUniformLoc("sceneInstances");
+                attributePtrsLoc = program.getUniformLoc("attributePtrs");
+                attributeIndicesLoc = program.getUniformLoc("attributeIndices");
+                attributePalettesLoc = program.getUniformLoc("attributePalettes");
+                useReprojectionLoc = program.getUniformLoc("useReprojection");
+                renderSizeLoc = program.getUniformLoc("renderSize");
+                programLoadStats = {cacheHit, timer.elapsed()};
 
                 glVertexArrayAttribFormat(vao.getID(), 0, 2, GL_FLOAT, GL_FALSE, 0);
                 glVertexArrayAttribBinding(vao.getID(), 0, 0);
@@ -259,28 +142,159 @@ public:
                 glVertexArrayElementBuffer(vao.getID(), quadIdxBuffer.getID());
         }
 
-        void loadOctree(VoxelOctree& oct) {
+        // Hit distances are read back by the next frame, so both images are
+        // the size of the framebuffer and stay bound to image units 0 and 1.
+        void initReprojection(const GLLib::ProgramCache& programCache) {
+                auto key = GLLib::ProgramCache::getKey({VoxelReprojectComp});
+                if (!programCache.load(reprojectProgram, key)) {
+                        auto comp = GLLib::Shader::fromString(GL_COMPUTE_SHADER, VoxelReprojectComp);
+                        reprojectProgram.addShader(comp);
+                        reprojectProgram.setBinaryRetrievable();
+                        reprojectProgram.link();
+                        programCache.store(reprojectProgram, key);
+                }
+                prevCameraLoc = reprojectProgram.getUniformLoc("prevCamera");
+                cameraInverseLoc = reprojectProgram.getUniformLoc("cameraInverse");
+                prevRenderSizeLoc = reprojectProgram.getUniformLoc("prevRenderSize");
+                reprojectRenderSizeLoc = reprojectProgram.getUniformLoc("renderSize");
+
+                glCreateTextures(GL_TEXTURE_2D, 1, &hitTexture);
+                glTextureStorage2D(hitTexture, 1, GL_R32F, width, height);
+                glBindImageTexture(0, hitTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+                glCreateTextures(GL_TEXTURE_2D, 1, &startTexture);
+                glTextureStorage2D(startTexture, 1, GL_R32UI, width, height);
+                glBindImageTexture(1, startTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+        }
+
+        void initSceneFramebuffer() {
+                glCreateTextures(GL_TEXTURE_2D, 1, &sceneColorTexture);
+                glTextureStorage2D(sceneColorTexture, 1, GL_RGBA8, width, height);
+                glCreateFramebuffers(1, &sceneFramebuffer);
+                glNamedFramebufferTexture(sceneFramebuffer, GL_COLOR_ATTACHMENT0, sceneColorTexture, 0);
+                glCreateQueries(GL_TIME_ELAPSED, TIME_QUERY_COUNT, timeQueries);
+        }
+
+        void loadScene(Scene& scene) {
+                program.use();
+                hasPrevFrame = false;
                 glDeleteTextures(1, &octreeTexture);
                 glCreateTextures(GL_TEXTURE_BUFFER, 1, &octreeTexture);
-                octreeBuffer.fill(oct.nodes, GL_STATIC_DRAW);
+                octreeBuffer.fill(scene.nodes, GL_STATIC_DRAW);
                 glTextureBuffer(octreeTexture, GL_R32UI, octreeBuffer.getID());
-                auto nodePool = program.getUniformLoc("nodePool");
-                glUniform1i(nodePool, 0);
+                glUniform1i(nodePoolLoc, 0);
                 glBindTextureUnit(0, octreeTexture);
+
+                auto bvhTexels = scene.packBvh();
+                glDeleteTextures(1, &bvhTexture);
+                glCreateTextures(GL_TEXTURE_BUFFER, 1, &bvhTexture);
+                bvhBuffer.fill(bvhTexels, GL_STATIC_DRAW);
+                glTextureBuffer(bvhTexture, GL_RGBA32F, bvhBuffer.getID());
+                glUniform1i(sceneBvhLoc, 1);
+                glBindTextureUnit(1, bvhTexture);
+
+                auto instanceTexels = scene.packInstances();
+                glDeleteTextures(1, &instanceTexture);
+                glCreateTextures(GL_TEXTURE_BUFFER, 1, &instanceTexture);
+                instanceBuffer.fill(instanceTexels, GL_STATIC_DRAW);
+                glTextureBuffer(instanceTexture, GL_RGBA32F, instanceBuffer.getID());
+                glUniform1i(sceneInstancesLoc, 2);
+                glBindTextureUnit(2, instanceTexture);
+
+                glDeleteTextures(1, &attributePtrTexture);
+                glCreateTextures(GL_TEXTURE_BUFFER, 1, &attributePtrTexture);
+                attributePtrBuffer.fill(scene.attributes.ptrs, GL_STATIC_DRAW);
+                glTextureBuffer(attributePtrTexture, GL_RG32UI, attributePtrBuffer.getID());
+                glUniform1i(attributePtrsLoc, 3);
+                glBindTextureUnit(3, attributePtrTexture);
+
+                glDeleteTextures(1, &attributeIndexTexture);
+                glCreateTextures(GL_TEXTURE_BUFFER, 1, &attributeIndexTexture);
+                attributeIndexBuffer.fill(scene.attributes.indices, GL_STATIC_DRAW);
+                glTextureBuffer(attributeIndexTexture, GL_R8UI, attributeIndexBuffer.getID());
+                glUniform1i(attributeIndicesLoc, 4);
+                glBindTextureUnit(4, attributeIndexTexture);
+
+                glDeleteTextures(1, &paletteTexture);
+                glCreateTextures(GL_TEXTURE_BUFFER, 1, &paletteTexture);
+                paletteBuffer.fill(scene.attributes.palettes, GL_STATIC_DRAW);
+                glTextureBuffer(paletteTexture, GL_RGBA8, paletteBuffer.getID());
+                glUniform1i(attributePalettesLoc, 5);
+                glBindTextureUnit(5, paletteTexture);
+        }
+
+        // A single octree is a scene with one untransformed instance.
+        void loadOctree(VoxelOctree& oct) {
+                Scene scene;
+                scene.addInstance(scene.addAsset(oct), glm::mat4(1.0f));
+                scene.build();
+                loadScene(scene);
         }
 
         void render(const Camera& camera) {
                 glfwMakeContextCurrent(window);
+                updateGovernor();
+                int renderWidth = governor.getScaled(width);
+                int renderHeight = governor.getScaled(height);
+
+                uint queryIdx = frameCount % TIME_QUERY_COUNT;
+                queryScales[queryIdx] = governor.getScale();
+                glBeginQuery(GL_TIME_ELAPSED, timeQueries[queryIdx]);
+
+                bool reproject = useReprojection && hasPrevFrame;
+                if (reproject) {
+                        GLuint noSample = 0x7F800000; // +infinity
+                        glClearTexImage(startTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &noSample);
+                        // Last frame's fragment shader wrote hitTexture.
+                        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                        reprojectProgram.use();
+                        glUniformMatrix4fv(prevCameraLoc, 1, GL_FALSE, glm::value_ptr(prevCameraTransform));
+                        glUniformMatrix4fv(cameraInverseLoc, 1, GL_FALSE, glm::value_ptr(glm::inverse(camera.getTransform())));
+                        glUniform2i(prevRenderSizeLoc, prevRenderWidth, prevRenderHeight);
+                        glUniform2i(reprojectRenderSizeLoc, renderWidth, renderHeight);
+                        glDispatchCompute((prevRenderWidth + 7) / 8, (prevRenderHeight + 7) / 8, 1);
+                        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                }
+
+                glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+                glViewport(0, 0, renderWidth, renderHeight);
                 glClearColor(0.0f, 0.3f, 0.2f, 1.0f);
                 glClear(GL_COLOR_BUFFER_BIT);
+                program.use();
                 vao.use();
-                auto camUni = program.getUniformLoc("camera");
-                glUniformMatrix4fv(camUni, 1, GL_FALSE, glm::value_ptr(camera.getTransform()));
+                glUniformMatrix4fv(cameraLoc, 1, GL_FALSE, glm::value_ptr(camera.getTransform()));
+                glUniform1i(useReprojectionLoc, reproject);
+                glUniform2i(renderSizeLoc, renderWidth, renderHeight);
 
                 glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, NULL);
+                glEndQuery(GL_TIME_ELAPSED);
+                prevCameraTransform = camera.getTransform();
+                prevRenderWidth = renderWidth;
+                prevRenderHeight = renderHeight;
+                hasPrevFrame = true;
+
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glViewport(0, 0, width, height);
+                glBlitNamedFramebuffer(sceneFramebuffer, 0,
+                        0, 0, renderWidth, renderHeight,
+                        0, 0, width, height,
+                        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+                frameCount++;
 
                 glfwSwapBuffers(window);
         }
+
+        // Hands the oldest timer query to the governor if the GPU is done
+        // with it. Frames whose result isn't in yet are just skipped.
+        void updateGovernor() {
+                if (frameCount < TIME_QUERY_COUNT - 1) { return; }
+                uint queryIdx = (frameCount + 1) % TIME_QUERY_COUNT;
+                GLint available = 0;
+                glGetQueryObjectiv(timeQueries[queryIdx], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available) { return; }
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(timeQueries[queryIdx], GL_QUERY_RESULT, &nanoseconds);
+                governor.update(queryScales[queryIdx], std::chrono::nanoseconds(nanoseconds));
+        }
 };
 
 
@@ -321,19 +335,60 @@ void simpleCameraMotion(Camera& camera, Window& window) {
         camera.rotation += rotation;
 }
 
+// Loads the world from a compressed archive, or builds it and writes the
+// archive if the file doesn't exist yet or can't be read, e.g. because it
+// was written by an older version.
+VoxelOctree loadOrCreateOctree(const char* archivePath) {
+        using ms = std::chrono::duration<double, std::milli>;
+        std::ifstream in(archivePath, std::ios::in | std::ios::binary);
+        if (in) {
+                try {
+                        auto archive = OctreeArchive::read(in);
+                        Timer timer;
+                        auto oct = archive.decompress();
+                        ms time = timer.elapsed();
+                        std::cout << "Decompressed " << archive.rawBytes() << " bytes in "
+                                  << time.count() << " ms ("
+                                  << archive.rawBytes() / time.count() * 1e-6 << " GB/s)" << std::endl;
+                        return oct;
+                }
+                catch (const std::runtime_error& e) {
+                        std::cerr << "Rebuilding " << archivePath << ": " << e.what() << std::endl;
+                }
+                in.close();
+        }
+
+        auto oct = VoxelOctree::create(10, true);
+        auto archive = OctreeArchive::compress(oct);
+        std::ofstream out(archivePath, std::ios::out | std::ios::binary);
+        archive.write(out);
+        std::cout << "Compressed " << archive.rawBytes() << " bytes to "
+                  << archive.compressedBytes() << " bytes ("
+                  << archive.compressionRatio() << "x, "
+                  << archive.blocks.size() << " blocks)" << std::endl;
+        return oct;
+}
+
 #include "glm/ext.hpp"
-int main() {
+int main(int argc, char** argv) {
         if (!glfwInit()) return -1;
 
         auto window = Window::create(1024, 768, "Hello, world!");
-        auto renderer = VoxelRenderer::create(window.window);
+        const char* cacheDir = std::getenv("VOXELS_CACHE_DIR");
+        auto programCache = GLLib::ProgramCache{cacheDir ? cacheDir : "."};
+        auto renderer = VoxelRenderer::create(window.window, programCache);
+        std::cout << "Shader program ready in "
+                  << std::chrono::duration<double, std::milli>(renderer.programLoadStats.time).count() << " ms ("
+                  << (renderer.programLoadStats.cacheHit ? "cached binary" : "compiled from source") << ")" << std::endl;
 
         auto camera = Camera::create();
 
-        auto oct = VoxelOctree::create();
+        auto oct = argc > 1 ? loadOrCreateOctree(argv[1]) : VoxelOctree::create(10, true);
 
         renderer.loadOctree(oct);
 
+        using ms = std::chrono::duration<double, std::milli>;
+        float reportedScale = renderer.governor.getScale();
         while(!window.shouldClose()) {
                 Timer timer;
                 simpleCameraMotion(camera, window);
@@ -343,6 +398,12 @@ int main() {
                 // std::cout << glm::to_string(camera.getTransform() * glm::vec4(0, 1, 0, 1)) << std::endl;
                 glfwPollEvents();
                 renderer.render(camera);
+                auto& history = renderer.governor.getHistory();
+                if (!history.empty() && history.back().nextScale != reportedScale) {
+                        reportedScale = history.back().nextScale;
+                        std::cout << "Render scale " << reportedScale << " (" << ms(history.back().renderTime).count()
+                                  << " ms at " << history.back().scale << ")" << std::endl;
+                }
                 timer.roundTo(std::chrono::microseconds(16666));
         }
 